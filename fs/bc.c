@@ -2,18 +2,186 @@
 #include "fs.h"
 #include "nvme.h"
 
+#define BLOCK2VA(blockno) ((void *)(uintptr_t)(DISKMAP + (blockno)*BLKSIZE))
+
+/* Blocks below this are never evicted (the superblock
+ * is accessed by the fault handler itself) */
+#define BC_PINNED 2
+
+/* Blocks resident in the cache, the first bc_stats.resident
+ * entries are used. Replacement is CLOCK over this array
+ * with PTE_A as the reference bit */
+static blockno_t bc_slots[BC_MAX_PAGES];
+static size_t bc_hand;
+
+struct BcStats bc_stats = {.budget = BC_MAX_PAGES};
+
+/* Blocks that might have been written since they were last flushed,
+ * marked by the write paths of fs.c and by write faults. PTE_D
+ * remains the authority, this set only limits what bc_sync() checks */
+static uint32_t bc_dirty[DISKSIZE / BLKSIZE / 32];
+
+/* Write-back policy, see bc_writeback(). The dirty set
+ * became non-empty at bc_dirty_since (in nanoseconds) */
+static unsigned bc_wb_interval = BC_WB_INTERVAL;
+static unsigned bc_wb_ratio = BC_WB_RATIO;
+static uint64_t bc_dirty_since;
+
+/* Monotonic time in nanoseconds */
+static uint64_t
+bc_now(void) {
+    struct timespec ts;
+    if (vsys_clock_gettime(CLOCK_MONOTONIC, &ts) < 0) return 0;
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Add block containing addr to the dirty set */
+void
+bc_mark_dirty(void *addr) {
+    blockno_t blockno = ((uintptr_t)addr - (uintptr_t)DISKMAP) / BLKSIZE;
+    assert(addr >= (void *)DISKMAP && addr < (void *)(DISKMAP + DISKSIZE));
+    if (!TSTBIT(bc_dirty, blockno)) {
+        if (!bc_stats.dirty) bc_dirty_since = bc_now();
+        SETBIT(bc_dirty, blockno);
+        bc_stats.dirty++;
+    }
+}
+
+static void
+bc_clear_dirty(blockno_t blockno) {
+    if (TSTBIT(bc_dirty, blockno)) {
+        CLRBIT(bc_dirty, blockno);
+        bc_stats.dirty--;
+    }
+}
+
+/* Block is resident and has been written since last flush */
+bool
+bc_block_dirty(blockno_t blockno) {
+    void *addr = BLOCK2VA(blockno);
+    return is_page_present(addr) && is_page_dirty(addr);
+}
+
+/* Sequential fault streams, a fault at 'next' continues
+ * the stream and doubles its readahead window */
+static struct {
+    blockno_t next;
+    size_t window;
+} bc_streams[BC_RA_STREAMS];
+static size_t bc_stream_victim;
+
+/* Number of blocks to read for fault at given block */
+static size_t
+bc_readahead_window(blockno_t blockno) {
+    size_t max = MIN(BC_RA_MAX, bc_stats.budget / 4);
+    if (blockno < BC_PINNED) return 1;
+
+    for (size_t i = 0; i < BC_RA_STREAMS; i++) {
+        if (bc_streams[i].next == blockno) {
+            bc_streams[i].window = MIN(bc_streams[i].window * 2, max);
+            bc_streams[i].next = blockno + bc_streams[i].window;
+            return bc_streams[i].window;
+        }
+    }
+
+    /* Start tracking a new potential stream */
+    size_t i = bc_stream_victim++ % BC_RA_STREAMS;
+    bc_streams[i].next = blockno + 1;
+    bc_streams[i].window = 1;
+    return 1;
+}
+
 /* Return the virtual address of this disk block. */
 void *
 diskaddr(blockno_t blockno) {
     if (blockno == 0 || (super && blockno >= super->s_nblocks))
         panic("bad block number %08x in diskaddr", blockno);
-    void *r = (void *)(uintptr_t)(DISKMAP + blockno * BLKSIZE);
+    void *r = BLOCK2VA(blockno);
 #ifdef SANITIZE_USER_SHADOW_BASE
     platform_asan_unpoison(r, BLKSIZE);
 #endif
+    if (is_page_present(r)) bc_stats.hits++;
     return r;
 }
 
+/* Write back (if dirty) and unmap the block in given slot */
+static void
+bc_evict_slot(size_t slot) {
+    void *addr = BLOCK2VA(bc_slots[slot]);
+    if (!is_page_present(addr)) return;
+
+    if (is_page_dirty(addr)) {
+        flush_block(addr);
+        bc_stats.writebacks++;
+    }
+
+    bc_clear_dirty(bc_slots[slot]);
+    int res = sys_unmap_region(CURENVID, addr, BLKSIZE);
+    if (res < 0) panic("bc_evict: can't sys_unmap_region(), errno %i\n", res);
+    bc_stats.evictions++;
+}
+
+/* Pick a slot for a new block, evicting one with CLOCK
+ * if the cache is full */
+static size_t
+bc_get_slot(void) {
+    if (bc_stats.resident < bc_stats.budget) return bc_stats.resident++;
+
+    /* Reference bits cleared by previous passes
+     * and blocks queued by flush_block_queued()
+     * need to be remapped before they can be evicted */
+    flush_queued();
+
+    size_t slot;
+    for (size_t scanned = 0;; scanned++) {
+        /* All blocks have been referenced, after
+         * the bits are cleared second pass finds a victim */
+        if (scanned == bc_stats.budget) flush_queued();
+        assert(scanned <= 2 * bc_stats.budget);
+
+        slot = bc_hand;
+        bc_hand = (bc_hand + 1) % bc_stats.budget;
+
+        void *addr = BLOCK2VA(bc_slots[slot]);
+        if (!is_page_present(addr)) break;
+
+        if (is_page_accessed(addr)) {
+            /* Give the block a second chance, remapping clears PTE_A
+             * (and PTE_D, so dirty blocks are written first) */
+            if (is_page_dirty(addr)) {
+                flush_block_queued(addr);
+                bc_stats.writebacks++;
+            } else {
+                batch_map_region(CURENVID, addr, CURENVID, addr, BLKSIZE, PTE_SYSCALL & get_prot(addr));
+            }
+            continue;
+        }
+
+        bc_evict_slot(slot);
+        break;
+    }
+
+    /* Second chance remaps must not be left in the ring, they would
+     * clear PTE_D of data the caller writes to the blocks next */
+    flush_queued();
+    return slot;
+}
+
+/* Set maximal number of resident blocks, evicting blocks over the new budget */
+int
+bc_set_budget(size_t npages) {
+    if (npages < BC_MIN_PAGES || npages > BC_MAX_PAGES) return -E_INVAL;
+
+    flush_queued();
+    for (size_t slot = npages; slot < bc_stats.resident; slot++)
+        bc_evict_slot(slot);
+
+    bc_stats.resident = MIN(bc_stats.resident, npages);
+    bc_stats.budget = npages;
+    bc_hand = 0;
+    return 0;
+}
+
 /* Fault any disk block that is read in to memory by
  * loading it from disk. */
 static bool
@@ -36,30 +204,57 @@ bc_pgfault(struct UTrapframe *utf) {
     int res;
     addr = ROUNDDOWN(addr, BLKSIZE);
 
-    if ((res = sys_alloc_region(CURENVID, addr, BLKSIZE, PROT_RW))) {
+    /* Read ahead on sequential faults, stopping at the
+     * first resident block or at the end of disk */
+    size_t nblocks = bc_readahead_window(blockno);
+    for (size_t i = 1; i < nblocks; i++) {
+        if (!super || blockno + i >= super->s_nblocks || is_page_present(BLOCK2VA(blockno + i))) {
+            nblocks = i;
+            break;
+        }
+    }
+
+    if ((res = sys_alloc_region(CURENVID, addr, nblocks * BLKSIZE, PROT_RW))) {
         panic("bc_pgfault: can't sys_alloc_region(), errno %i\n", res);
     }
 
-    *(uint8_t *)addr = 0; 
+    /* Make pages resident, NVMe needs their physical addresses */
+    for (size_t i = 0; i < nblocks; i++)
+        *((volatile uint8_t *)addr + i * BLKSIZE) = 0;
 
-    if ((res = nvme_read(BLKSECTS * blockno, addr, BLKSECTS)) != NVME_OK) {
+    if ((res = nvme_read(BLKSECTS * blockno, addr, BLKSECTS * nblocks)) != NVME_OK) {
         panic("bc_pgfault: can't nvme_read(), errno %i\n", res);
     }
 
+    /* Clear PTE_D and PTE_A set by making the pages resident, only real
+     * writes should make blocks dirty and only real accesses referenced */
+    if ((res = sys_map_region(CURENVID, addr, CURENVID, addr, nblocks * BLKSIZE, PTE_SYSCALL & get_prot(addr))) < 0) {
+        panic("bc_pgfault: can't sys_map_region(), errno %i\n", res);
+    }
+
+    /* Faulting write has not happened yet */
+    if (utf->utf_err & FEC_W) bc_mark_dirty(addr);
+
+    bc_stats.misses++;
+    bc_stats.reads++;
+    bc_stats.readahead += nblocks - 1;
+    for (size_t i = 0; i < nblocks; i++)
+        if (blockno + i >= BC_PINNED) bc_slots[bc_get_slot()] = blockno + i;
+
     return 1;
 }
 
 /* Flush the contents of the block containing VA out to disk if
- * necessary, then clear the PTE_D bit using sys_map_region().
+ * necessary, then queue clearing the PTE_D bit with sys_map_region()
+ * in the syscall ring; it is cleared by the next flush_queued().
  * If the block is not in the block cache or is not dirty, does
  * nothing.
  * Hint: Use is_page_present(), is_page_dirty(), and ide_write().
  * Hint: Use the PTE_SYSCALL constant when calling sys_map_region().
  * Hint: Don't forget to round addr down. */
 void
-flush_block(void *addr) {
+flush_block_queued(void *addr) {
     blockno_t blockno = ((uintptr_t)addr - (uintptr_t)DISKMAP) / BLKSIZE;
-    int res;
 
     if (addr < (void *)(uintptr_t)DISKMAP || addr >= (void *)(uintptr_t)(DISKMAP + DISKSIZE))
         panic("flush_block of bad va %p", addr);
@@ -67,22 +262,140 @@ flush_block(void *addr) {
         panic("reading non-existent block %08x out of %08x\n", blockno, super->s_nblocks);
 
     // LAB 10: Your code here.
-    // (void)res;
     addr = ROUNDDOWN(addr, BLKSIZE);
 
     if (!is_page_present(addr) || !is_page_dirty(addr)) {
+        bc_clear_dirty(blockno);
         return;
     }
 
-    if ((res = nvme_write(BLKSECTS * blockno, addr, BLKSECTS)) != NVME_OK) {
+    flush_blocks_queued(blockno, 1);
+}
+
+/* Write out 'n' contiguous resident dirty blocks starting
+ * from 'blockno' with a single NVMe command and queue
+ * clearing their PTE_D bits like flush_block_queued() */
+void
+flush_blocks_queued(blockno_t blockno, size_t n) {
+    void *addr = BLOCK2VA(blockno);
+    int res;
+
+    assert(n && n <= BC_WB_MAX);
+
+    if ((res = nvme_write(BLKSECTS * blockno, addr, BLKSECTS * n)) != NVME_OK) {
         panic("flush_block: can't nvme_write(), errno %i\n", res);
     }
 
-    if ((res = sys_map_region(CURENVID, addr, CURENVID, addr, BLKSIZE, PTE_SYSCALL & get_prot(addr)))) {
-        panic("flush_block: can't sys_map_region(), errno %i\n", res);
+    /* Remapping the blocks clears their dirty bits */
+    batch_map_region(CURENVID, addr, CURENVID, addr, n * BLKSIZE, PTE_SYSCALL & get_prot(addr));
+
+    for (size_t i = 0; i < n; i++)
+        bc_clear_dirty(blockno + i);
+    bc_stats.writes++;
+    bc_stats.written += n;
+}
+
+/* Write out all dirty blocks, coalescing contiguous
+ * runs; only blocks in the dirty set are examined */
+void
+bc_sync(void) {
+    blockno_t start = 0;
+    size_t n = 0;
+
+    for (blockno_t b = 1; bc_stats.dirty && b < super->s_nblocks; b++) {
+        if (!(b % 32) && !bc_dirty[b / 32]) {
+            b += 31;
+            if (n) flush_blocks_queued(start, n);
+            n = 0;
+            continue;
+        }
+
+        bool dirty = 0;
+        if (TSTBIT(bc_dirty, b)) {
+            if (!(dirty = bc_block_dirty(b))) bc_clear_dirty(b);
+        }
+
+        if (dirty && n && start + n == b && n < BC_WB_MAX) {
+            n++;
+            continue;
+        }
+
+        if (n) flush_blocks_queued(start, n);
+        n = 0;
+        if (dirty) start = b, n = 1;
     }
 
-    assert(!is_page_dirty(addr));
+    if (n) flush_blocks_queued(start, n);
+    flush_queued();
+    bc_stats.syncs++;
+}
+
+/* Set the write-back policy: dirty blocks are written by bc_writeback()
+ * once the oldest of them is 'interval' ms old or once they exceed
+ * 'ratio' percent of the cache budget. Interval 0 disables deferred
+ * write-back, file_flush() callers then write synchronously.
+ * Negative values keep the current setting */
+int
+bc_set_writeback(int interval, int ratio) {
+    if (ratio > 100) return -E_INVAL;
+
+    if (interval >= 0) bc_wb_interval = interval;
+    if (ratio >= 0) bc_wb_ratio = ratio;
+    if (!bc_wb_interval) bc_sync();
+    return 0;
+}
+
+void
+bc_get_writeback(unsigned *interval, unsigned *ratio) {
+    *interval = bc_wb_interval;
+    *ratio = bc_wb_ratio;
+}
+
+bool
+bc_writeback_enabled(void) {
+    return bc_wb_interval != 0;
+}
+
+/* Nanoseconds left until the dirty set is due to be written,
+ * 0 if there is nothing to write */
+uint64_t
+bc_writeback_timeout(void) {
+    if (!bc_stats.dirty || !bc_wb_interval) return 0;
+
+    uint64_t deadline = bc_dirty_since + bc_wb_interval * 1000000ULL;
+    uint64_t now = bc_now();
+    return now < deadline ? deadline - now : 1;
+}
+
+/* Write out the dirty set if it has aged out or grown over the
+ * dirty ratio. Runs are written sorted and merged by bc_sync(),
+ * so metadata such as bitmap blocks dirtied by many operations
+ * reach the disk once. Returns whether anything was written */
+bool
+bc_writeback(void) {
+    if (!bc_stats.dirty) return 0;
+
+    if (bc_wb_interval && bc_stats.dirty * 100 < bc_stats.budget * bc_wb_ratio &&
+        bc_now() - bc_dirty_since < bc_wb_interval * 1000000ULL) return 0;
+
+    bc_sync();
+    return 1;
+}
+
+/* Clear the dirty bits of the blocks written by flush_block_queued() */
+void
+flush_queued(void) {
+    int res = batch_submit();
+    if (res < 0)
+        panic("flush_block: can't sys_map_region(), errno %i\n", res);
+}
+
+/* Flush the block containing VA out to disk and clear its PTE_D bit */
+void
+flush_block(void *addr) {
+    flush_block_queued(addr);
+    flush_queued();
+    assert(!is_page_dirty(ROUNDDOWN(addr, BLKSIZE)));
 }
 
 /* Test that the block cache works, by smashing the superblock and
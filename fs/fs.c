@@ -37,17 +37,95 @@ block_is_free(blockno_t blockno) {
     return 0;
 }
 
+/* Free block summary: number of free blocks in each group of
+ * BLKGROUP blocks, allocation skips full groups without looking
+ * at their bitmap words. Allocation is next-fit, continuing where
+ * the previous one ended unless the caller has a better goal */
+static uint32_t group_free[DISKSIZE / BLKSIZE / BLKGROUP];
+static blockno_t nfree;
+static blockno_t alloc_hint;
+
+/* Fill in the free block summary from the bitmap */
+static void
+bitmap_init(void) {
+    nfree = 0;
+    memset(group_free, 0, sizeof(group_free));
+    for (blockno_t b = 0; b < super->s_nblocks; b++) {
+        if (block_is_free(b)) {
+            group_free[b / BLKGROUP]++;
+            nfree++;
+        }
+    }
+}
+
 /* Mark a block free in the bitmap */
 void
 free_block(blockno_t blockno) {
     /* Blockno zero is the null pointer of block numbers. */
     if (blockno == 0) panic("attempt to free zero block");
+    if (!TSTBIT(bitmap, blockno)) {
+        group_free[blockno / BLKGROUP]++;
+        nfree++;
+    }
     SETBIT(bitmap, blockno);
+    bc_mark_dirty(&bitmap[blockno / 32]);
 }
 
-/* Search the bitmap for a free block and allocate it.  When you
- * allocate a block, immediately flush the changed bitmap block
- * to disk.
+/* Return the first free block at or after 'goal', wrapping
+ * around at the end of disk, 0 if the disk is full */
+static blockno_t
+bitmap_find_free(blockno_t goal) {
+    blockno_t ngroups = CEILDIV(super->s_nblocks, BLKGROUP);
+
+    if (!nfree) return 0;
+    if (goal >= super->s_nblocks) goal = 0;
+
+    /* The last pass scans the beginning of the goal's group */
+    for (blockno_t i = 0; i <= ngroups; i++) {
+        blockno_t group = (goal / BLKGROUP + i) % ngroups;
+        if (!group_free[group]) continue;
+
+        blockno_t end = MIN((group + 1) * BLKGROUP, super->s_nblocks);
+        for (blockno_t b = i ? group * BLKGROUP : goal; b < end; b = ROUNDDOWN(b, 32) + 32) {
+            uint32_t word = bitmap[b / 32] & (~0U << (b % 32));
+            if (word) {
+                b = ROUNDDOWN(b, 32) + __builtin_ctz(word);
+                if (b < end) return b;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Allocate up to 'count' contiguous blocks, starting with the first
+ * free block at or after 'goal' (any block if 'goal' is 0).
+ * Sets *start to the first block of the run and returns its length,
+ * 0 if the disk is full. Changed bitmap blocks are added to the dirty
+ * set, so that allocations are written out together by the write-back */
+size_t
+alloc_blocks(blockno_t goal, size_t count, blockno_t *start) {
+    blockno_t blkno = bitmap_find_free(goal ? goal : alloc_hint);
+    size_t n = 0;
+
+    if (!blkno) return 0;
+
+    while (n < count && block_is_free(blkno + n)) {
+        CLRBIT(bitmap, blkno + n);
+        bc_mark_dirty(&bitmap[(blkno + n) / 32]);
+        group_free[(blkno + n) / BLKGROUP]--;
+        nfree--;
+        n++;
+    }
+
+    alloc_hint = blkno + n;
+    *start = blkno;
+    return n;
+}
+
+/* Search the bitmap for a free block and allocate it.
+ * The changed bitmap block is added to the dirty set.
  *
  * Return block number allocated on success,
  * 0 if we are out of blocks.
@@ -60,24 +138,9 @@ alloc_block(void) {
      * super->s_nblocks blocks in the disk altogether. */
 
     // LAB 10: Your code here
-    blockno_t blkno = 0, j = 0;
-
-    while (j < super->s_nblocks) {
-        if (bitmap[j / 32]) {
-            for (blockno_t i = 0; i < 32; i++) {
-                if (block_is_free(j + i)) {
-                    blkno = j + i;
-                    CLRBIT(bitmap, blkno);
-                    flush_block(&bitmap[blkno / 32]);
-                    return blkno;
-                }
-            }
-        }
-
-        j += 32;
-    }
+    blockno_t blkno;
 
-    return 0;
+    return alloc_blocks(0, 1, &blkno) ? blkno : 0;
 }
 
 /* Validate the file system bitmap.
@@ -118,6 +181,7 @@ fs_init(void) {
     bitmap = diskaddr(2);
 
     check_bitmap();
+    bitmap_init();
 }
 
 /* Find the disk block number slot for the 'filebno'th block in file 'f'.
@@ -158,8 +222,9 @@ file_block_walk(struct File *f, blockno_t filebno, blockno_t **ppdiskbno, bool a
             }
             
             f->f_indirect = new_block;
-            f->f_size++;
+            bc_mark_dirty(f);
             memset(diskaddr(f->f_indirect), 0, BLKSIZE);
+            bc_mark_dirty(diskaddr(f->f_indirect));
         }
 
         *ppdiskbno = ((blockno_t *)diskaddr(f->f_indirect)) + filebno - NDIRECT;
@@ -168,17 +233,51 @@ file_block_walk(struct File *f, blockno_t filebno, blockno_t **ppdiskbno, bool a
     return 0;
 }
 
-/* Set *blk to the address in memory where the filebno'th
- * block of file 'f' would be mapped.
- *
- * Returns 0 on success, < 0 on error.  Errors are:
- *  -E_NO_DISK if a block needed to be allocated but the disk is full.
- *  -E_INVAL if filebno is out of range.
- *
- * Hint: Use file_block_walk and alloc_block. */
-int
-file_get_block(struct File *f, blockno_t filebno, char **blk) {
-    // LAB 10: Your code here
+/* Where to allocate the filebno'th block of file 'f': right after
+ * its previous block, so that files are laid out contiguously.
+ * 0 (the global next-fit position) if there is no previous block */
+static blockno_t
+file_alloc_goal(struct File *f, blockno_t filebno) {
+    blockno_t *pdiskbno;
+
+    if (!filebno || file_block_walk(f, filebno - 1, &pdiskbno, 0) < 0 || !*pdiskbno)
+        return 0;
+    return *pdiskbno + 1;
+}
+
+/* Allocate the missing blocks among 'count' blocks of file 'f'
+ * starting from 'filebno', taking contiguous runs from the bitmap.
+ * Returns 0 on success, < 0 on error. */
+static int
+file_alloc_range(struct File *f, blockno_t filebno, blockno_t count) {
+    blockno_t *pdiskbno, start = 0;
+    size_t nrun = 0;
+    int res = 0;
+
+    for (blockno_t i = 0; i < count; i++) {
+        if ((res = file_block_walk(f, filebno + i, &pdiskbno, 1)) < 0) break;
+        if (*pdiskbno) continue;
+
+        if (!nrun && !(nrun = alloc_blocks(file_alloc_goal(f, filebno + i), count - i, &start))) {
+            res = -E_NO_DISK;
+            break;
+        }
+
+        *pdiskbno = start++;
+        nrun--;
+        bc_mark_dirty(pdiskbno);
+    }
+
+    /* Blocks of the run that turned out not to be needed */
+    while (nrun--)
+        free_block(start++);
+    return res;
+}
+
+/* file_get_block() which does not add the block to the dirty set
+ * unless 'write' is set, for callers that only read it */
+static int
+file_map_block(struct File *f, blockno_t filebno, char **blk, bool write) {
     blockno_t *pdiskbno = NULL;
     int res = 0;
 
@@ -187,19 +286,36 @@ file_get_block(struct File *f, blockno_t filebno, char **blk) {
     }
 
     if (!(*pdiskbno)) {
-        blockno_t new_block = alloc_block();
-        
-        if (!new_block) {
+        blockno_t new_block;
+
+        if (!alloc_blocks(file_alloc_goal(f, filebno), 1, &new_block)) {
             return -E_NO_DISK;
         }
 
         *pdiskbno = new_block;
+        bc_mark_dirty(pdiskbno);
     }
 
     *blk = (char *)diskaddr(*pdiskbno);
+    if (write) bc_mark_dirty(*blk);
     return 0;
 }
 
+/* Set *blk to the address in memory where the filebno'th
+ * block of file 'f' would be mapped.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_NO_DISK if a block needed to be allocated but the disk is full.
+ *  -E_INVAL if filebno is out of range.
+ *
+ * Hint: Use file_block_walk and alloc_block. */
+int
+file_get_block(struct File *f, blockno_t filebno, char **blk) {
+    // LAB 10: Your code here
+    /* Callers can write to the block */
+    return file_map_block(f, filebno, blk, 1);
+}
+
 /* Try to find a file named "name" in dir.  If so, set *file to it.
  *
  * Returns 0 and sets *file on success, < 0 on error.  Errors are:
@@ -213,7 +329,7 @@ dir_lookup(struct File *dir, const char *name, struct File **file) {
     blockno_t nblock = dir->f_size / BLKSIZE;
     for (blockno_t i = 0; i < nblock; i++) {
         char *blk;
-        int res = file_get_block(dir, i, &blk);
+        int res = file_map_block(dir, i, &blk, 0);
         if (res < 0) return res;
 
         struct File *f = (struct File *)blk;
@@ -247,6 +363,7 @@ dir_alloc_file(struct File *dir, struct File **file) {
         }
     }
     dir->f_size += BLKSIZE;
+    bc_mark_dirty(dir);
     int res = file_get_block(dir, nblock, &blk);
     if (res < 0) return res;
 
@@ -359,7 +476,7 @@ file_read(struct File *f, void *buf, size_t count, off_t offset) {
     count = MIN(count, f->f_size - offset);
 
     for (off_t pos = offset; pos < offset + count;) {
-        int r = file_get_block(f, pos / BLKSIZE, &blk);
+        int r = file_map_block(f, pos / BLKSIZE, &blk, 0);
         if (r < 0) return r;
 
         int bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
@@ -379,9 +496,18 @@ ssize_t
 file_write(struct File *f, const void *buf, size_t count, off_t offset) {
     int res;
 
-    /* Extend file if necessary */
-    if (offset + count > f->f_size)
-        if ((res = file_set_size(f, offset + count)) < 0) return res;
+    /* Extend file if necessary, the new size
+     * is written back with the data */
+    if (offset + count > f->f_size) {
+        blockno_t first = MAX(offset, f->f_size) / BLKSIZE;
+        blockno_t last = CEILDIV(offset + count, BLKSIZE);
+
+        f->f_size = offset + count;
+        bc_mark_dirty(f);
+
+        /* Appended blocks are allocated as contiguous runs */
+        if (first < last && (res = file_alloc_range(f, first, last - first)) < 0) return res;
+    }
 
     for (off_t pos = offset; pos < offset + count;) {
         char *blk;
@@ -407,6 +533,7 @@ file_free_block(struct File *f, blockno_t filebno) {
     if (*ptr) {
         free_block(*ptr);
         *ptr = 0;
+        bc_mark_dirty(ptr);
     }
     return 0;
 }
@@ -432,6 +559,7 @@ file_truncate_blocks(struct File *f, off_t newsize) {
     if (new_nblocks <= NDIRECT && f->f_indirect) {
         free_block(f->f_indirect);
         f->f_indirect = 0;
+        bc_mark_dirty(f);
     }
 }
 
@@ -445,31 +573,81 @@ file_set_size(struct File *f, off_t newsize) {
     return 0;
 }
 
+/* Drop empty blocks from the end of directory 'dir',
+ * so that lookups don't scan entries of removed files */
+static void
+dir_trim(struct File *dir) {
+    blockno_t nblock = dir->f_size / BLKSIZE;
+
+    for (; nblock > 0; nblock--) {
+        char *blk;
+        if (file_map_block(dir, nblock - 1, &blk, 0) < 0) break;
+
+        struct File *f = (struct File *)blk;
+        blockno_t j = 0;
+        while (j < BLKFILES && f[j].f_name[0] == '\0')
+            j++;
+        if (j < BLKFILES) break;
+    }
+
+    if (nblock * BLKSIZE < dir->f_size) {
+        file_truncate_blocks(dir, nblock * BLKSIZE);
+        dir->f_size = nblock * BLKSIZE;
+        bc_mark_dirty(dir);
+    }
+}
+
+/* Remove a file by truncating it and then zeroing the name. */
+int
+file_remove(const char *path) {
+    struct File *dir, *f;
+    int res;
+
+    if ((res = walk_path(path, &dir, &f, 0)) < 0) return res;
+    if (!dir) return -E_INVAL;
+
+    file_truncate_blocks(f, 0);
+    f->f_size = 0;
+    f->f_name[0] = '\0';
+    bc_mark_dirty(f);
+    dir_trim(dir);
+    return 0;
+}
+
 /* Flush the contents and metadata of file f out to disk.
  * Loop over all the blocks in file.
  * Translate the file block number into a disk block number
- * and then check whether that disk block is dirty.  If so, write it out. */
+ * and then check whether that disk block is dirty.  If so, write it out.
+ * Dirty blocks that are contiguous on disk are written together. */
 void
 file_flush(struct File *f) {
-    blockno_t *pdiskbno;
+    blockno_t *pdiskbno, start = 0;
+    size_t n = 0;
 
     for (blockno_t i = 0; i < CEILDIV(f->f_size, BLKSIZE); i++) {
         if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-            pdiskbno == NULL || *pdiskbno == 0)
+            pdiskbno == NULL || *pdiskbno == 0 || !bc_block_dirty(*pdiskbno))
             continue;
-        flush_block(diskaddr(*pdiskbno));
+
+        if (n && start + n == *pdiskbno && n < BC_WB_MAX) {
+            n++;
+        } else {
+            if (n) flush_blocks_queued(start, n);
+            start = *pdiskbno;
+            n = 1;
+        }
     }
+    if (n) flush_blocks_queued(start, n);
     if (f->f_indirect)
-        flush_block(diskaddr(f->f_indirect));
-    flush_block(f);
+        flush_block_queued(diskaddr(f->f_indirect));
+    flush_block_queued(f);
+    flush_queued();
 }
 
 /* Sync the entire file system.  A big hammer. */
 void
 fs_sync(void) {
-    for (int i = 1; i < super->s_nblocks; i++) {
-        flush_block(diskaddr(i));
-    }
+    bc_sync();
 }
 
 int
@@ -11,13 +11,60 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE 0xC0000000
 
+/* Blocks per group of the free block summary */
+#define BLKGROUP 1024
+
+/* Limits of the number of blocks resident in the block cache */
+#define BC_MIN_PAGES 8
+#define BC_MAX_PAGES 4096
+
+/* Maximal readahead window in blocks and number of tracked streams */
+#define BC_RA_MAX     32
+#define BC_RA_STREAMS 4
+/* Maximal number of blocks written by a single command */
+#define BC_WB_MAX 32
+
+/* Default write-back policy: dirty blocks are written once the
+ * oldest of them is this old or once they make up this percentage
+ * of the cache budget */
+#define BC_WB_INTERVAL 1000 /* ms */
+#define BC_WB_RATIO    25   /* % */
+
+struct BcStats {
+    uint64_t hits;       /* diskaddr() of a resident block */
+    uint64_t misses;     /* Faults on non-resident blocks */
+    uint64_t reads;      /* NVMe read commands */
+    uint64_t readahead;  /* Blocks read ahead of faults */
+    uint64_t evictions;  /* Blocks unmapped to stay within budget */
+    uint64_t writebacks; /* Dirty blocks written by eviction */
+    uint64_t writes;     /* NVMe write commands */
+    uint64_t written;    /* Blocks written */
+    uint64_t syncs;      /* Write-back passes over the dirty set */
+    size_t resident;     /* Evictable blocks in memory */
+    size_t budget;       /* Maximal number of evictable blocks */
+    size_t dirty;        /* Blocks in the dirty set */
+};
+
 extern struct Super *super; /* superblock */
 extern uint32_t *bitmap;    /* bitmap blocks mapped in memory */
 
 /* bc.c */
 void *diskaddr(blockno_t blockno);
 void flush_block(void *addr);
+void flush_block_queued(void *addr);
+void flush_queued(void);
+void flush_blocks_queued(blockno_t blockno, size_t n);
+void bc_mark_dirty(void *addr);
+bool bc_block_dirty(blockno_t blockno);
+void bc_sync(void);
 void bc_init(void);
+int bc_set_budget(size_t npages);
+int bc_set_writeback(int interval, int ratio);
+void bc_get_writeback(unsigned *interval, unsigned *ratio);
+bool bc_writeback_enabled(void);
+bool bc_writeback(void);
+uint64_t bc_writeback_timeout(void);
+extern struct BcStats bc_stats;
 
 /* fs.c */
 void fs_init(void);
@@ -35,6 +82,7 @@ int fifo_create(const char *path, struct File **f);
 
 bool block_is_free(blockno_t blockno);
 blockno_t alloc_block(void);
+size_t alloc_blocks(blockno_t goal, size_t count, blockno_t *start);
 
 /* test.c */
 void fs_test(void);
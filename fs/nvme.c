@@ -662,26 +662,76 @@ nvme_cmd_rw(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, int opc
     return res;
 }
 
-int
-nvme_write(uint64_t secno, const void *src, size_t nsecs) {
-    if (!src)
+/* PRP list used by transfers spanning more than two pages */
+static uint64_t nvme_prp_list[NVME_PAGE_SIZE / sizeof(uint64_t)] ALIGNED(NVME_PAGE_SIZE);
+
+/**
+ * Fill PRP entries describing virtually contiguous buffer,
+ * that can be physically discontiguous.
+ * @param   ctl         controller
+ * @param   va          buffer address
+ * @param   size        buffer size
+ * @param   prp1        first PRP entry
+ * @param   prp2        second PRP entry or PRP list address
+ * @return  0 if ok else errcode != 0.
+ */
+static int
+nvme_setup_prp(struct NvmeController *ctl, const void *va, size_t size, uint64_t *prp1, uint64_t *prp2) {
+    uintptr_t start = ROUNDDOWN((uintptr_t)va, NVME_PAGE_SIZE);
+    size_t npages = (ROUNDUP((uintptr_t)va + size, NVME_PAGE_SIZE) - start) / NVME_PAGE_SIZE;
+
+    if (!npages || npages > ctl->ci.maxppio || npages - 1 > sizeof nvme_prp_list / sizeof *nvme_prp_list)
         return -NVME_BAD_ARG;
 
-    return nvme_cmd_rw(&nvme, &nvme.ioq[0], NVME_CMD_WRITE,
-                       nvme.nsi.id, secno, nsecs, get_phys_addr((void *)src), 0);
+    *prp1 = get_phys_addr((void *)va);
+    *prp2 = 0;
+    if (npages == 2) {
+        *prp2 = get_phys_addr((void *)(start + NVME_PAGE_SIZE));
+    } else if (npages > 2) {
+        for (size_t i = 1; i < npages; i++)
+            nvme_prp_list[i - 1] = get_phys_addr((void *)(start + i * NVME_PAGE_SIZE));
+        *prp2 = get_phys_addr(nvme_prp_list);
+    }
+
+    return NVME_OK;
 }
 
+/* Transfer 'nsecs' sectors, split into commands the controller
+ * accepts when the buffer spans more than ci.maxppio pages */
+static int
+nvme_rw(int opc, uint64_t secno, void *buf, size_t nsecs) {
+    uint64_t prp1, prp2;
+    int res = NVME_OK;
+
+    if (!buf) return -NVME_BAD_ARG;
+
+    while (nsecs && res == NVME_OK) {
+        size_t room = nvme.ci.maxppio * NVME_PAGE_SIZE - (uintptr_t)buf % NVME_PAGE_SIZE;
+        size_t n = MIN(nsecs, room >> nvme.nsi.blockshift);
+        if (!n || nvme_setup_prp(&nvme, buf, n << nvme.nsi.blockshift, &prp1, &prp2) != NVME_OK)
+            return -NVME_BAD_ARG;
+
+        res = nvme_cmd_rw(&nvme, &nvme.ioq[0], opc, nvme.nsi.id, secno, n, prp1, prp2);
+        secno += n;
+        nsecs -= n;
+        buf += n << nvme.nsi.blockshift;
+    }
+
+    return res;
+}
 
 int
-nvme_read(uint64_t secno, void *dst, size_t nsecs) {
-    if (!dst)
-        return -NVME_BAD_ARG;
+nvme_write(uint64_t secno, const void *src, size_t nsecs) {
+    return nvme_rw(NVME_CMD_WRITE, secno, (void *)src, nsecs);
+}
+
 
+int
+nvme_read(uint64_t secno, void *dst, size_t nsecs) {
     /* Submit NVME_CMD_READ to ioq[0].
      * TIP: This is achieved in exactly the same way as the write command.
      *      Remember that the command takes physical address as an argument
      *      and 'dst' is a virtual address. */
     // LAB 10: Your code here
-    return nvme_cmd_rw(&nvme, &nvme.ioq[0], NVME_CMD_READ, 
-                       nvme.nsi.id, secno, nsecs, get_phys_addr(dst), 0);
+    return nvme_rw(NVME_CMD_READ, secno, dst, nsecs);
 }
@@ -466,10 +466,47 @@ serve_flush(envid_t envid, union Fsipc *ipc) {
     int res = openfile_lookup(envid, req->req_fileid, &o);
     if (res < 0) return res;
 
-    file_flush(o->o_file);
+    /* With deferred write-back the blocks age out
+     * with the rest of the dirty set */
+    if (!bc_writeback_enabled()) file_flush(o->o_file);
     return 0;
 }
 
+/* Set the write-back policy (negative fields are left unchanged)
+ * and return the write-back counters on the request page. */
+int
+serve_writeback(envid_t envid, union Fsipc *ipc) {
+    struct Fsreq_writeback *req = &ipc->writeback;
+    struct Fsret_writeback *ret = &ipc->writebackRet;
+
+    if (debug) cprintf("serve_writeback %08x %d %d\n", envid, req->req_interval, req->req_ratio);
+
+    int res = bc_set_writeback(req->req_interval, req->req_ratio);
+    if (res < 0) return res;
+
+    bc_get_writeback(&ret->ret_interval, &ret->ret_ratio);
+    ret->ret_writes = bc_stats.writes;
+    ret->ret_written = bc_stats.written;
+    ret->ret_syncs = bc_stats.syncs;
+    ret->ret_dirty = bc_stats.dirty;
+    return 0;
+}
+
+/* Remove the file req->req_path */
+int
+serve_remove(envid_t envid, union Fsipc *ipc) {
+    struct Fsreq_remove *req = &ipc->remove;
+    char path[MAXPATHLEN];
+
+    if (debug) cprintf("serve_remove %08x %s\n", envid, req->req_path);
+
+    /* Copy in the path, making sure it's null-terminated */
+    memmove(path, req->req_path, MAXPATHLEN);
+    path[MAXPATHLEN - 1] = 0;
+
+    return file_remove(path);
+}
+
 int
 serve_sync(envid_t envid, union Fsipc *req) {
     fs_sync();
@@ -521,7 +558,9 @@ fshandler handlers[] = {
         [FSREQ_FLUSH] = serve_flush,
         [FSREQ_WRITE] = serve_write,
         [FSREQ_SET_SIZE] = serve_set_size,
+        [FSREQ_REMOVE] = serve_remove,
         [FSREQ_SYNC] = serve_sync,
+        [FSREQ_WRITEBACK] = serve_writeback,
         // [FSREQ_CREATE_FIFO] = serve_create_fifo,
         [FSREQ_READ_FIFO]  = serve_read_fifo,
 	    [FSREQ_STAT_FIFO]  = serve_stat_fifo,
@@ -530,16 +569,32 @@ fshandler handlers[] = {
 };
 #define NHANDLERS (sizeof(handlers) / sizeof(handlers[0]))
 
+/* Wait for the next request. While there are dirty blocks
+ * the wait times out when they are due to be written back */
+static uint32_t
+serve_recv(uint32_t *whom, int *perm) {
+    uint64_t timeout;
+    size_t sz = PAGE_SIZE;
+
+    while ((timeout = bc_writeback_timeout())) {
+        int32_t res = ipc_recv_timeout((int32_t *)whom, fsreq, &sz, perm, timeout);
+        if (res != -E_TIMEOUT) return res;
+        bc_writeback();
+    }
+
+    return ipc_recv((int32_t *)whom, fsreq, &sz, perm);
+}
+
 void
 serve(void) {
     uint32_t req, whom;
     int perm, res;
     void *pg;
 
+    perm = 0;
+    req = serve_recv(&whom, &perm);
+
     while (1) {
-        perm = 0;
-        size_t sz = PAGE_SIZE;
-        req = ipc_recv((int32_t *)&whom, fsreq, &sz, &perm);
         if (debug) {
             cprintf("fs req %d from %08x [page %08lx: %s]\n",
                     req, whom, (unsigned long)get_uvpt_entry(fsreq),
@@ -549,7 +604,10 @@ serve(void) {
         /* All requests must contain an argument page */
         if (!(perm & PROT_R)) {
             cprintf("Invalid request from %08x: no argument page\n", whom);
-            continue; /* Just leave it hanging... */
+            /* Just leave it hanging... */
+            perm = 0;
+            req = serve_recv(&whom, &perm);
+            continue;
         }
 
         pg = NULL;
@@ -563,8 +621,24 @@ serve(void) {
             cprintf("Invalid request code %d from %08x\n", req, whom);
             res = -E_INVAL;
         }
-        ipc_send(whom, res, pg, PAGE_SIZE, perm);
         sys_unmap_region(0, fsreq, PAGE_SIZE);
+
+        /* Write back the dirty set if it is old or large enough */
+        bc_writeback();
+
+        int reply_perm = perm;
+        perm = 0;
+        if (bc_writeback_timeout()) {
+            /* Dirty blocks are pending, wait for the next
+             * request with a timeout so that they age out */
+            ipc_send(whom, res, pg, PAGE_SIZE, reply_perm);
+            req = serve_recv(&whom, &perm);
+            continue;
+        }
+
+        /* Reply and wait for the next request in one system call,
+         * the kernel switches straight back to the client */
+        req = ipc_reply_recv(whom, res, pg, PAGE_SIZE, reply_perm, (int32_t *)&whom, fsreq, &perm);
     }
 }
 
@@ -44,6 +44,97 @@ check_dir(struct File *dir) {
     }
 }
 
+#define STREAM_BUDGET BC_MIN_PAGES * 2
+#define STREAM_BLOCKS (STREAM_BUDGET * 4)
+
+/* Streams a file larger than the block cache budget
+ * through the cache and checks that it is evicted
+ * and written back correctly */
+static void
+check_bc_stream(void) {
+    struct File *f;
+    uint8_t *buf = (uint8_t *)(2 * PAGE_SIZE);
+    size_t budget = bc_stats.budget;
+    uint64_t evictions = bc_stats.evictions;
+    int r;
+
+    if ((r = sys_alloc_region(0, buf, PAGE_SIZE, PROT_RW)) < 0)
+        panic("sys_page_alloc: %i", r);
+    if ((r = bc_set_budget(STREAM_BUDGET)) < 0)
+        panic("bc_set_budget: %i", r);
+
+    /* Can be left over by an interrupted run */
+    if ((r = file_create("/bcstream", &f)) == -E_FILE_EXISTS)
+        r = file_open("/bcstream", &f);
+    if (r < 0)
+        panic("file_create /bcstream: %i", r);
+    for (size_t i = 0; i < STREAM_BLOCKS; i++) {
+        memset(buf, (uint8_t)(i ^ 0x5A), PAGE_SIZE);
+        if ((r = file_write(f, buf, PAGE_SIZE, i * PAGE_SIZE)) != PAGE_SIZE)
+            panic("file_write /bcstream: %i", r);
+        assert(bc_stats.resident <= STREAM_BUDGET);
+    }
+    file_flush(f);
+
+    /* Once the bitmap is written too, reading evicts only clean blocks */
+    fs_sync();
+    uint64_t writebacks = bc_stats.writebacks;
+    for (size_t i = 0; i < STREAM_BLOCKS; i++) {
+        if ((r = file_read(f, buf, PAGE_SIZE, i * PAGE_SIZE)) != PAGE_SIZE)
+            panic("file_read /bcstream: %i", r);
+        for (size_t j = 0; j < PAGE_SIZE; j++)
+            if (buf[j] != (uint8_t)(i ^ 0x5A)) panic("/bcstream block %zu is corrupted", i);
+        assert(bc_stats.resident <= STREAM_BUDGET);
+    }
+    assert(bc_stats.evictions > evictions);
+    assert(bc_stats.writebacks == writebacks);
+
+    /* Free blocks and directory entry */
+    if ((r = file_set_size(f, 0)) < 0)
+        panic("file_set_size /bcstream: %i", r);
+    f->f_name[0] = '\0';
+    flush_block(f);
+    if ((r = bc_set_budget(budget)) < 0)
+        panic("bc_set_budget: %i", r);
+    sys_unmap_region(0, buf, PAGE_SIZE);
+
+    cprintf("block cache: %lu hits, %lu misses, %lu evictions, %lu writebacks\n",
+            (unsigned long)bc_stats.hits, (unsigned long)bc_stats.misses,
+            (unsigned long)bc_stats.evictions, (unsigned long)bc_stats.writebacks);
+    cprintf("block cache eviction is good\n");
+}
+
+/* Creates enough files to push the root directory past its
+ * direct blocks, then removes them and checks that the
+ * directory shrinks back */
+static void
+check_remove(void) {
+    struct File *root = &super->s_root, *f;
+    off_t size = root->f_size;
+    char path[MAXPATHLEN];
+    int n, r;
+
+    for (n = 0; root->f_size <= NDIRECT * BLKSIZE; n++) {
+        snprintf(path, sizeof(path), "/rmtest%d", n);
+        /* Can be left over by an interrupted run */
+        if ((r = file_create(path, &f)) < 0 && r != -E_FILE_EXISTS)
+            panic("file_create %s: %i", path, r);
+    }
+    assert(root->f_size % BLKSIZE == 0);
+    assert(root->f_indirect);
+
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "/rmtest%d", i);
+        if ((r = file_remove(path)) < 0)
+            panic("file_remove %s: %i", path, r);
+        if ((r = file_open(path, &f)) != -E_NOT_FOUND)
+            panic("file_open %s after remove: %i", path, r);
+    }
+    assert(root->f_size <= size);
+    assert(size > NDIRECT * BLKSIZE || !root->f_indirect);
+    cprintf("file_remove is good\n");
+}
+
 void
 fs_test(void) {
     struct File *f;
@@ -104,4 +195,7 @@ fs_test(void) {
     assert(!is_page_dirty(blk));
     assert(!is_page_dirty(f));
     cprintf("file rewrite is good\n");
+
+    check_remove();
+    check_bc_stream();
 }
@@ -54,10 +54,27 @@ struct List {
     struct List *prev, *next;
 };
 
+/* Entries of per address space virtual tree lookup cache.
+ * The cache of a space is valid while its vcache_gen equals its
+ * vtree_gen. Anything that can change the virtual tree of a space
+ * (a lookup that may allocate or split nodes, an unmap) bumps that
+ * space's vtree_gen, so the caches of other spaces are kept. */
+#define VCACHE_SIZE 8
+
+struct VCacheEntry {
+    uintptr_t start, end; /* Range covered by node */
+    struct Page *node;    /* Deepest virtual tree node for the range */
+};
+
 struct AddressSpace {
     pml4e_t *pml4;     /* Virtual address of pml4 */
     uintptr_t cr3;     /* Physical address of pml4 */
     struct Page *root; /* root node of address space tree */
+    uint16_t pcid;     /* TLB tag of this space (0 for kspace) */
+    bool pcid_stale;   /* TLB may hold old entries for pcid */
+    uint64_t vtree_gen;                     /* Bumped whenever the virtual tree changes */
+    uint64_t vcache_gen;                    /* Tree generation vcache is valid for */
+    struct VCacheEntry vcache[VCACHE_SIZE]; /* Recent lookups */
 };
 
 struct QueuedSignal {
@@ -65,14 +82,32 @@ struct QueuedSignal {
     struct sigaction qs_act;
 };
 
+/* Per-env CPU accounting, readable by user environments through envs[].
+ * Total CPU time is vsys_runtime[] of the vsyscall page, the time spent
+ * in the kernel on behalf of the env is that minus acct_utime */
+struct EnvAcct {
+    uint64_t acct_utime;        /* TSC cycles spent in user mode */
+    uint64_t acct_stamp;        /* TSC at the last user/kernel boundary */
+    uint32_t acct_switches;     /* Times switched to from another env */
+    uint32_t acct_pgfault_kern; /* Page faults resolved by the kernel */
+    uint32_t acct_pgfault_user; /* Page faults passed to the upcall */
+    uint32_t acct_ipc_sends;    /* IPC messages delivered from this env */
+    uint32_t acct_ipc_recvs;    /* IPC messages delivered to this env */
+    uint64_t acct_fault_bytes;  /* Private memory allocated by lazy page faults */
+};
+
 struct Env {
     struct Trapframe env_tf; /* Saved registers */
     struct Env *env_link;    /* Next free Env */
+    struct List env_runq_link; /* Link in the scheduler run queue */
+    struct List env_sleep_link; /* Link in the timer wheel while sleeping */
+    uint64_t env_sleep_deadline; /* Wakeup time, ns since boot */
     envid_t env_id;          /* Unique environment identifier */
     envid_t env_parent_id;   /* env_id of this env's parent */
     enum EnvType env_type;   /* Indicates special system environments */
     unsigned env_status;     /* Status of the environment */
     uint32_t env_runs;       /* Number of times environment has run */
+    struct EnvAcct env_acct; /* CPU time and event counters */
 
     uint8_t *binary; /* Pointer to process ELF image in kernel memory */
 
@@ -90,6 +125,14 @@ struct Env {
     envid_t env_ipc_from;    /* envid of the sender */
     int env_ipc_perm;        /* Perm of page mapping received */
 
+    struct List env_ipc_senders;  /* Envs blocked in sys_ipc_send to us */
+    struct List env_ipc_link;     /* Link in receiver's env_ipc_senders */
+    uint32_t env_ipc_send_value;  /* Value being sent by blocked sender */
+    uintptr_t env_ipc_send_srcva; /* VA of region being sent */
+    size_t env_ipc_send_size;     /* Size of region being sent */
+    int env_ipc_send_perm;        /* Perm of region being sent */
+    bool env_ipc_calling;         /* Blocked sender waits for a reply */
+
     /* LAB 13: Your code here: */
     struct sigaction env_sig_sa[NSIGNALS];              /* Array of all signal handlers */
     struct QueuedSignal env_sig_queue[SIG_QUEUE_SIZE];  /* Circle queue of signals */
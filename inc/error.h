@@ -30,6 +30,7 @@ enum {
     /* itask addition for signals */
     E_AGAIN = 20,       /* Resource temporarily unavailable, try again */
     E_FIFO_CLOSED = 21, /* fifo file doesn't have any writers or readers */
+    E_TIMEOUT = 22,     /* Timed out */
     MAXERROR
 };
 
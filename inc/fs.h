@@ -91,7 +91,9 @@ enum {
     FSREQ_READ_FIFO,
 	FSREQ_WRITE_FIFO,
 	FSREQ_STAT_FIFO,
-	FSREQ_CLOSE_FIFO
+	FSREQ_CLOSE_FIFO,
+    /* Writeback returns a Fsret_writeback on the request page */
+    FSREQ_WRITEBACK
 };
 
 union Fsipc {
@@ -154,6 +156,18 @@ union Fsipc {
 	struct Fsreq_close_fifo {
 		int req_fileid;
 	} close_fifo;
+    struct Fsreq_writeback {
+        int req_interval; /* ms, 0 writes on every request, < 0 keeps current */
+        int req_ratio;    /* % of block cache, < 0 keeps current */
+    } writeback;
+    struct Fsret_writeback {
+        unsigned ret_interval;
+        unsigned ret_ratio;
+        uint64_t ret_writes;  /* NVMe write commands */
+        uint64_t ret_written; /* Blocks written */
+        uint64_t ret_syncs;   /* Write-back passes */
+        size_t ret_dirty;     /* Blocks waiting for write-back */
+    } writebackRet;
 
     /* Ensure Fsipc is one page */
     char _pad[PAGE_SIZE];
@@ -16,6 +16,7 @@
 #include <inc/env.h>
 #include <inc/memlayout.h>
 #include <inc/syscall.h>
+#include <inc/sysring.h>
 #include <inc/vsyscall.h>
 #include <inc/trap.h>
 #include <inc/fs.h>
@@ -39,7 +40,7 @@ void umain(int argc, char **argv);
 
 /* libmain.c or entry.S */
 extern const char *binaryname;
-extern const volatile int vsys[];
+extern const volatile struct Vsys vsys;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 
@@ -95,10 +96,28 @@ int sys_map_physical_region(uintptr_t pa, envid_t dst_env,
                             void *dst_pg, size_t size, int perm);
 int sys_unmap_region(envid_t env, void *pg, size_t size);
 int sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
-int sys_ipc_recv(void *rcv_pg, size_t size);
+int sys_ipc_send(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
+int sys_ipc_recv(void *rcv_pg, size_t size, uint64_t timeout);
+int sys_ipc_call(envid_t to_env, uint64_t value, void *pg, size_t size, int perm, void *rcv_pg);
+int sys_ipc_reply_recv(envid_t to_env, uint64_t value, void *pg, size_t size, int perm, void *rcv_pg);
 int sys_gettime(void);
-
+int sys_sleep(uint64_t ns);
+int sys_enter_batch(struct SyscallRing *ring);
+
+/* sysring.c */
+void batch_syscall(uintptr_t num, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6);
+void batch_alloc_region(envid_t env, void *pg, size_t size, int perm);
+void batch_map_region(envid_t src_env, void *src_pg,
+                      envid_t dst_env, void *dst_pg, size_t size, int perm);
+void batch_unmap_region(envid_t env, void *pg, size_t size);
+int batch_submit(void);
+
+/* vsyscall.c */
 int vsys_gettime(void);
+envid_t vsys_getenvid(void);
+int vsys_clock_gettime(int clock_id, struct timespec *ts);
+int nanosleep(const struct timespec *req);
+uint64_t vsys_env_runtime(envid_t envid);
 
 int sys_sigqueue(pid_t pid, int signo, const union sigval value);
 int sys_sigwait(const sigset_t * set, int * sig);
@@ -118,6 +137,10 @@ sys_exofork(void) {
 /* ipc.c */
 void ipc_send(envid_t to_env, uint32_t value, void *pg, size_t size, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, size_t *psize, int *perm_store);
+int32_t ipc_recv_timeout(envid_t *from_env_store, void *pg, size_t *psize, int *perm_store, uint64_t timeout);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, size_t size, int perm, void *rcv_pg, int *perm_store);
+int32_t ipc_reply_recv(envid_t to_env, uint32_t value, void *pg, size_t size, int perm,
+                       envid_t *from_env_store, void *rcv_pg, int *perm_store);
 envid_t ipc_find_env(enum EnvType type);
 
 /* fork.c */
@@ -130,6 +153,7 @@ pte_t get_uvpt_entry(void *addr);
 uintptr_t get_phys_addr(void *va);
 int get_prot(void *va);
 bool is_page_dirty(void *va);
+bool is_page_accessed(void *va);
 bool is_page_present(void *va);
 
 /* fd.c */
@@ -148,6 +172,7 @@ int open(const char *path, int mode);
 int ftruncate(int fd, off_t size);
 int remove(const char *path);
 int sync(void);
+int fs_writeback(int interval, int ratio, struct Fsret_writeback *stat);
 
 /* spawn.c */
 envid_t spawn(const char *program, const char **argv);
@@ -3,7 +3,6 @@
 
 #ifndef __ASSEMBLER__
 #include <inc/types.h>
-#include <inc/vsyscall.h>
 #include <inc/mmu.h>
 #endif /* not __ASSEMBLER__ */
 
@@ -17,8 +16,10 @@
 #define GD_KD   0x10 /* kernel data */
 #define GD_KT32 0x18 /* kernel text 32bit */
 #define GD_KD32 0x20 /* kernel data 32bit */
-#define GD_UT   0x28 /* user text */
-#define GD_UD   0x30 /* user data */
+/* SYSRET takes user SS and CS from two consecutive descriptors
+ * after the one in STAR, so user data must go right before user text */
+#define GD_UD   0x28 /* user data */
+#define GD_UT   0x30 /* user text */
 #define GD_TSS0 0x38 /* Task segment selector for CPU 0 */
 
 /*
@@ -147,7 +148,7 @@
 #define UENVS      (MAX_USER_READABLE - UENVS_SIZE)
 
 /* Virtual syscall page */
-#define UVSYS_SIZE PAGE_SIZE
+#define UVSYS_SIZE (3 * PAGE_SIZE)
 #define UVSYS      (UENVS - UVSYS_SIZE)
 
 /*
@@ -139,12 +139,23 @@
 #define CR4_SMAP       0x00200000 /* SMAP Enable */
 #define CR4_PKE        0x00400000 /* Protected Key Enable */
 
+/* CR3 bits used with CR4_PCIDE */
+#define CR3_PCID_MASK 0xFFFULL      /* Process-context identifier */
+#define CR3_NOFLUSH   (1ULL << 63)  /* Keep TLB entries of loaded PCID */
+#define NPCID         4096
+
 /* x86_64 related changes */
 #define EFER_MSR 0xC0000080
+#define EFER_SCE (1ULL << 0)
 #define EFER_LME (1ULL << 8)
 #define EFER_LMA (1ULL << 10)
 #define EFER_NXE (1ULL << 11)
 
+/* SYSCALL/SYSRET configuration */
+#define STAR_MSR   0xC0000081 /* Segment selectors */
+#define LSTAR_MSR  0xC0000082 /* 64-bit SYSCALL entry point */
+#define SFMASK_MSR 0xC0000084 /* RFLAGS bits cleared on SYSCALL */
+
 /* RFLAGS register */
 #define FL_CF        0x00000001 /* Carry Flag */
 #define FL_PF        0x00000004 /* Parity Flag */
@@ -18,6 +18,13 @@ char *strfind(const char *s, int c);
 void *memset(void *dst, int c, size_t len);
 void *memcpy(void *restrict dst, const void *restrict src, size_t len);
 void *memmove(void *dst, const void *src, size_t len);
+
+/* memcpy()/memset() call through these, the kernel
+ * switches them to the variants below on ERMS CPUs */
+extern void *(*memcpy_impl)(void *dst, const void *src, size_t len);
+extern void *(*memset_impl)(void *dst, int c, size_t len);
+void *memcpy_movsb(void *dst, const void *src, size_t len);
+void *memset_stosb(void *dst, int c, size_t len);
 int memcmp(const void *s1, const void *s2, size_t len);
 void *memfind(const void *s, int c, size_t len);
 
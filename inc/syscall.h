@@ -18,8 +18,13 @@ enum {
     SYS_env_set_pgfault_upcall,
     SYS_yield,
     SYS_ipc_try_send,
+    SYS_ipc_send,
     SYS_ipc_recv,
+    SYS_ipc_call,
+    SYS_ipc_reply_recv,
     SYS_gettime,
+    SYS_sleep,
+    SYS_enter_batch,
     // LAB 13: Your code here:
     SYS_sigqueue,
     SYS_sigwait,
@@ -0,0 +1,41 @@
+#ifndef JOS_INC_SYSRING_H
+#define JOS_INC_SYSRING_H
+
+#include <inc/types.h>
+
+/* Shared-memory system call ring.
+ *
+ * An environment queues system calls in the submission ring (sq) and enters
+ * the kernel once with sys_enter_batch() to have all of them executed; one
+ * completion per submission is posted to the completion ring (cq) in order.
+ *
+ * Each ring is single-producer/single-consumer: the environment owns sq_tail
+ * and cq_head, the kernel owns sq_head and cq_tail.  Indices grow without
+ * wrapping and are reduced modulo the ring size on access.  The whole
+ * structure fits in one page so that the environment's own writes to the
+ * submission ring fault in a private copy before the kernel writes to it. */
+
+#define SYSRING_SQ_ENTRIES 48
+#define SYSRING_CQ_ENTRIES 48
+
+struct SyscallSqe {
+    uint64_t sqe_num;
+    uint64_t sqe_args[6];
+    uint64_t sqe_data; /* Copied verbatim to the completion */
+};
+
+struct SyscallCqe {
+    int64_t cqe_res;
+    uint64_t cqe_data;
+};
+
+struct SyscallRing {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    struct SyscallSqe sq[SYSRING_SQ_ENTRIES];
+    struct SyscallCqe cq[SYSRING_CQ_ENTRIES];
+};
+
+#endif /* !JOS_INC_SYSRING_H */
@@ -1,10 +1,50 @@
 #ifndef JOS_INC_VSYSCALL_H
 #define JOS_INC_VSYSCALL_H
 
-/* system call numbers */
-enum {
-    VSYS_gettime,
-    NVSYSCALLS
+#include <inc/types.h>
+#include <inc/env.h>
+
+/* Layout of the read-only page the kernel shares with every
+ * environment at UVSYS, read by lib/vsyscall.c without trapping.
+ *
+ * The clock is TSC based: nanoseconds since boot are
+ * (rdtsc - vsys_tsc_base) scaled by vsys_tsc_freq.  The clock
+ * fields are protected by a seqlock, the kernel keeps vsys_seq
+ * odd while it updates them, so readers retry if they saw an odd
+ * or changed sequence number. */
+struct Vsys {
+    uint32_t vsys_seq;           /* Clock seqlock sequence number */
+    int32_t vsys_boot_time;      /* Wall clock at vsys_tsc_base, seconds since the epoch */
+    uint64_t vsys_tsc_base;      /* TSC value at boot */
+    uint64_t vsys_tsc_freq;      /* TSC ticks per second */
+    envid_t vsys_curenv;         /* Currently running environment */
+    uint64_t vsys_runtime[NENV]; /* TSC ticks each envs[] slot has been running */
+};
+
+#define NSEC_PER_SEC 1000000000ULL
+#define USEC_PER_SEC 1000000ULL
+
+/* Convert TSC ticks to nanoseconds at 'freq' ticks
+ * per second without overflowing 64 bits */
+static inline uint64_t
+tsc2ns(uint64_t ticks, uint64_t freq) {
+    return ticks / freq * NSEC_PER_SEC + ticks % freq * NSEC_PER_SEC / freq;
+}
+
+/* Same for microseconds, returns ticks if the frequency is unknown */
+static inline uint64_t
+tsc2us(uint64_t ticks, uint64_t freq) {
+    if (!freq) return ticks;
+    return ticks / freq * USEC_PER_SEC + ticks % freq * USEC_PER_SEC / freq;
+}
+
+/* Clocks for vsys_clock_gettime() */
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
 };
 
 #endif /* !JOS_INC_VSYSCALL_H */
@@ -150,6 +150,21 @@ lcr3(uint64_t val) {
     asm volatile("movq %0,%%cr3" ::"r"(val));
 }
 
+/* INVPCID invalidation types */
+#define INVPCID_ADDRESS 0 /* Single address in given PCID */
+#define INVPCID_SINGLE  1 /* All non-global entries of given PCID */
+#define INVPCID_ALL     2 /* All entries including global ones */
+
+static inline void __attribute__((always_inline))
+invpcid(uint64_t type, uint64_t pcid, uintptr_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = {pcid, addr};
+    asm volatile("invpcid %0, %1" ::"m"(desc), "r"(type)
+                 : "memory");
+}
+
 static inline uint64_t __attribute__((always_inline))
 rcr3(void) {
     uint64_t val;
@@ -183,9 +198,7 @@ rdmsr(uint32_t msr) {
 static inline void __attribute__((always_inline))
 wrmsr(uint32_t msr, uint64_t val) {
     uint64_t rax = val & 0xFFFFFFFF, rdx = val >> 32;
-    asm volatile("rdmsr"
-                 : "=a"(rax), "=d"(rdx)
-                 : "c"(msr));
+    asm volatile("wrmsr" ::"c"(msr), "a"(rax), "d"(rdx));
 }
 
 static inline void __attribute__((always_inline))
@@ -245,6 +258,18 @@ cpuid(uint32_t info, uint32_t *raxp, uint32_t *rbxp, uint32_t *rcxp, uint32_t *r
     if (rdxp) *rdxp = edx;
 }
 
+static inline void __attribute__((always_inline))
+cpuid_count(uint32_t info, uint32_t count, uint32_t *raxp, uint32_t *rbxp, uint32_t *rcxp, uint32_t *rdxp) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid"
+                 : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                 : "a"(info), "c"(count));
+    if (raxp) *raxp = eax;
+    if (rbxp) *rbxp = ebx;
+    if (rcxp) *rcxp = ecx;
+    if (rdxp) *rdxp = edx;
+}
+
 static inline uint64_t __attribute__((always_inline))
 read_tsc(void) {
     uint32_t lo, hi;
@@ -3,16 +3,7 @@
 
 #include <inc/types.h>
 
-/* block header */
-struct header {
-    /* next block */
-    struct header *next;
-    /* prev block */
-    struct header *prev;
-    /* size of this block */
-    size_t size;
-} __attribute__((packed, aligned(_Alignof(max_align_t))));
-
-typedef struct header Header;
+void *test_alloc(uint8_t nbytes);
+void test_free(void *ap);
 
 #endif
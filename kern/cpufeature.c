@@ -0,0 +1,90 @@
+/* CPUID feature table and selection of
+ * routine variants depending on it */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/cpufeature.h>
+#include <kern/pmap.h>
+
+uint64_t cpu_features;
+
+enum { REG_EAX, REG_EBX, REG_ECX, REG_EDX };
+
+static const struct {
+    const char *name;
+    uint32_t leaf, subleaf;
+    uint8_t reg, bit;
+} feature_table[NCPUFEATURES] = {
+        [CPU_FEATURE_NX] = {"nx", 0x80000001, 0, REG_EDX, 20},
+        [CPU_FEATURE_PDPE1GB] = {"pdpe1gb", 0x80000001, 0, REG_EDX, 26},
+        [CPU_FEATURE_PCID] = {"pcid", 1, 0, REG_ECX, 17},
+        [CPU_FEATURE_INVPCID] = {"invpcid", 7, 0, REG_EBX, 10},
+        [CPU_FEATURE_ERMS] = {"erms", 7, 0, REG_EBX, 9},
+        [CPU_FEATURE_FSRM] = {"fsrm", 7, 0, REG_EDX, 4},
+        [CPU_FEATURE_SSE4_2] = {"sse4_2", 1, 0, REG_ECX, 20},
+        [CPU_FEATURE_AVX2] = {"avx2", 7, 0, REG_EBX, 5},
+        [CPU_FEATURE_XSAVE] = {"xsave", 1, 0, REG_ECX, 26},
+        [CPU_FEATURE_TSC_DEADLINE] = {"tsc_deadline", 1, 0, REG_ECX, 24},
+        [CPU_FEATURE_INVARIANT_TSC] = {"invariant_tsc", 0x80000007, 0, REG_EDX, 8},
+};
+
+/*
+ * Alternatives: function pointers that are switched to faster
+ * implementation at boot if CPU has all the 'features'.
+ * The first matching entry for a slot wins, the default
+ * value of the pointer is used if none matches
+ */
+static struct Alternative {
+    void **slot;
+    void *impl;
+    uint64_t features;
+    const char *name;
+} alternatives[] = {
+        {(void **)&memcpy_impl, memcpy_movsb, 1ULL << CPU_FEATURE_ERMS, "memcpy: rep movsb"},
+        {(void **)&memset_impl, memset_stosb, 1ULL << CPU_FEATURE_ERMS, "memset: rep stosb"},
+        {(void **)&tlb_invalidate_range, tlb_invalidate_range_pcid,
+         (1ULL << CPU_FEATURE_PCID) | (1ULL << CPU_FEATURE_INVPCID), "tlb flush: invpcid"},
+};
+
+#define NALTERNATIVES (sizeof(alternatives) / sizeof(*alternatives))
+
+/* Slot of entry was patched by this entry */
+static bool applied[NALTERNATIVES];
+
+void
+cpu_features_init(void) {
+    uint32_t maxleaf, maxext;
+    cpuid(0, &maxleaf, NULL, NULL, NULL);
+    cpuid(0x80000000, &maxext, NULL, NULL, NULL);
+
+    for (size_t i = 0; i < NCPUFEATURES; i++) {
+        uint32_t leaf = feature_table[i].leaf, regs[4];
+        if (leaf > (leaf & 0x80000000 ? maxext : maxleaf)) continue;
+
+        cpuid_count(leaf, feature_table[i].subleaf, &regs[REG_EAX], &regs[REG_EBX], &regs[REG_ECX], &regs[REG_EDX]);
+        if (regs[feature_table[i].reg] & (1U << feature_table[i].bit))
+            cpu_features |= 1ULL << i;
+    }
+
+    for (size_t i = 0; i < NALTERNATIVES; i++) {
+        struct Alternative *alt = &alternatives[i];
+        bool taken = 0;
+        for (size_t j = 0; j < i; j++)
+            taken |= applied[j] && alternatives[j].slot == alt->slot;
+        if (!taken && (cpu_features & alt->features) == alt->features) {
+            *alt->slot = alt->impl;
+            applied[i] = 1;
+        }
+    }
+}
+
+void
+dump_cpu_features(void) {
+    for (size_t i = 0; i < NCPUFEATURES; i++)
+        cprintf("%-14s %s\n", feature_table[i].name, cpu_has(i) ? "yes" : "no");
+
+    for (size_t i = 0; i < NALTERNATIVES; i++)
+        cprintf("%-24s %s\n", alternatives[i].name, applied[i] ? "applied" : "not applied");
+}
@@ -0,0 +1,35 @@
+#ifndef JOS_KERN_CPUFEATURE_H
+#define JOS_KERN_CPUFEATURE_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* CPU features detected with CPUID at boot */
+enum CpuFeature {
+    CPU_FEATURE_NX,            /* No-execute page bit */
+    CPU_FEATURE_PDPE1GB,       /* 1GB pages */
+    CPU_FEATURE_PCID,          /* Process-context identifiers */
+    CPU_FEATURE_INVPCID,       /* INVPCID instruction */
+    CPU_FEATURE_ERMS,          /* Enhanced REP MOVSB/STOSB */
+    CPU_FEATURE_FSRM,          /* Fast short REP MOVSB */
+    CPU_FEATURE_SSE4_2,        /* SSE4.2 */
+    CPU_FEATURE_AVX2,          /* AVX2 */
+    CPU_FEATURE_XSAVE,         /* XSAVE/XRSTOR */
+    CPU_FEATURE_TSC_DEADLINE,  /* Local APIC TSC-deadline timer mode */
+    CPU_FEATURE_INVARIANT_TSC, /* TSC rate is constant in all states */
+    NCPUFEATURES,
+};
+
+extern uint64_t cpu_features;
+
+static inline bool
+cpu_has(enum CpuFeature feature) {
+    return cpu_features & (1ULL << feature);
+}
+
+void cpu_features_init(void);
+void dump_cpu_features(void);
+
+#endif
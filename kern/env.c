@@ -10,7 +10,9 @@
 #include <inc/signal.h>
 
 #include <kern/env.h>
+#include <kern/kclock.h>
 #include <kern/kdebug.h>
+#include <kern/ktimer.h>
 #include <kern/macro.h>
 #include <kern/monitor.h>
 #include <kern/pmap.h>
@@ -18,6 +20,7 @@
 #include <kern/sched.h>
 #include <kern/timer.h>
 #include <kern/traceopt.h>
+#include <kern/tsc.h>
 #include <kern/trap.h>
 #include <kern/vsyscall.h>
 #include <kern/syscall.h>
@@ -35,12 +38,15 @@ struct Env *envs = NULL;
 #endif
 
 /* Virtual syscall page address */
-volatile int *vsys;
+volatile struct Vsys *vsys;
 
 /* Free environment list
  * (linked by Env->env_link) */
 static struct Env *env_free_list;
 
+/* TSC value when curenv was switched to */
+static uint64_t curenv_start_tsc;
+
 
 /* NOTE: Should be at least LOGNENV */
 #define ENVGENSHIFT 12
@@ -100,8 +106,16 @@ env_init(void) {
      * Don't forget about rounding.
      * kzalloc_region only works with current_space != NULL */
     // LAB 12: Your code here
+    static_assert(sizeof(struct Vsys) <= UVSYS_SIZE, "struct Vsys doesn't fit into UVSYS");
     vsys = kzalloc_region(UVSYS_SIZE);
     memset((void *)vsys, 0, UVSYS_SIZE);
+
+    /* Publish TSC clock parameters, see struct Vsys */
+    vsys->vsys_seq++;
+    vsys->vsys_tsc_freq = tsc_calibrate();
+    vsys->vsys_boot_time = gettime();
+    vsys->vsys_tsc_base = read_tsc();
+    vsys->vsys_seq++;
     /* Allocate envs array with kzalloc_region().
      * Don't forget about rounding.
      * kzalloc_region() only works with current_space != NULL */
@@ -162,6 +176,9 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 #endif
     env->env_status = ENV_RUNNABLE;
     env->env_runs = 0;
+    memset(&env->env_acct, 0, sizeof(env->env_acct));
+    vsys->vsys_runtime[env - envs] = 0;
+    sched_enqueue(env);
 
     /* Clear out all the saved register state,
      * to prevent the register values
@@ -203,6 +220,8 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
 
     /* Also clear the IPC receiving flag. */
     env->env_ipc_recving = 0;
+    env->env_ipc_calling = 0;
+    env->env_ipc_senders.next = env->env_ipc_senders.prev = &env->env_ipc_senders;
 
     /* Clear signal related fields in Env structure */
     /* LAB 13: Your code here: */
@@ -485,6 +504,9 @@ env_free(struct Env *env) {
 #endif
 
     /* Return the environment to the free list */
+    ipc_cancel(env);
+    ktimer_cancel(env);
+    sched_dequeue(env);
     env->env_status = ENV_FREE;
     env->env_link = env_free_list;
     env_free_list = env;
@@ -543,6 +565,8 @@ csys_yield(struct Trapframe *tf) {
 
 _Noreturn void
 env_pop_tf(struct Trapframe *tf) {
+    if (curenv && (tf->tf_cs & 3)) env_account_resume(curenv);
+
     asm volatile(
             "movq %0, %%rsp\n"
             "movq 0(%%rsp), %%r15\n"
@@ -596,6 +620,33 @@ int env_check4pending_sigs(struct Env *env) {
     return -1;
 }
 
+/* Charge the time since curenv was switched to to its runtime
+ * counter in the vsyscall page and restart the measurement */
+void
+env_charge_runtime(void) {
+    uint64_t now = read_tsc();
+
+    if (curenv) vsys->vsys_runtime[curenv - envs] += now - curenv_start_tsc;
+    curenv_start_tsc = now;
+}
+
+/* Charge the time since env's last user/kernel boundary to its user time.
+ * Called on entry to the kernel from user mode. */
+void
+env_account_user(struct Env *env) {
+    uint64_t now = read_tsc();
+    env->env_acct.acct_utime += now - env->env_acct.acct_stamp;
+    env->env_acct.acct_stamp = now;
+}
+
+/* Start measuring env's user time, called when env returns to user mode.
+ * Kernel time is not charged separately, it is derived from the runtime
+ * counter maintained by env_charge_runtime() */
+void
+env_account_resume(struct Env *env) {
+    env->env_acct.acct_stamp = read_tsc();
+}
+
 /* Context switch from curenv to env.
  * This function does not return.
  *
@@ -629,12 +680,21 @@ env_run(struct Env *env) {
 
     // LAB 3: Your code here
     // LAB 8: Your code here
-    if (curenv) {
+    if (curenv != env) {
+        env_charge_runtime();
+        vsys->vsys_curenv = env->env_id;
+
+        env->env_acct.acct_switches++;
+    }
+
+    if (curenv && curenv != env) {
         if (curenv->env_status == ENV_RUNNING) {
             curenv->env_status = ENV_RUNNABLE;
+            sched_enqueue(curenv);
         }
     }
 
+    sched_dequeue(env);
     curenv = env;
     curenv->env_status = ENV_RUNNING;
     curenv->env_runs++;
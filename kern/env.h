@@ -21,6 +21,9 @@ void env_destroy(struct Env *env);
 
 int envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 _Noreturn void env_run(struct Env *e);
+void env_charge_runtime(void);
+void env_account_user(struct Env *env);
+void env_account_resume(struct Env *env);
 _Noreturn void env_pop_tf(struct Trapframe *tf);
 
 #ifdef CONFIG_KSPACE
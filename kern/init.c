@@ -9,7 +9,9 @@
 #include <kern/monitor.h>
 #include <kern/tsc.h>
 #include <kern/console.h>
+#include <kern/cpufeature.h>
 #include <kern/pmap.h>
+#include <kern/kmalloc.h>
 #include <kern/env.h>
 #include <kern/timer.h>
 #include <kern/trap.h>
@@ -17,6 +19,7 @@
 #include <kern/picirq.h>
 #include <kern/kclock.h>
 #include <kern/kdebug.h>
+#include <kern/ktimer.h>
 #include <kern/traceopt.h>
 
 void
@@ -134,6 +137,9 @@ i386_init(void) {
      * Can't call cprintf until after we do this! */
     cons_init();
 
+    /* Detect CPU features and pick routine variants for them */
+    cpu_features_init();
+
     tsc_calibrate();
 
     if (trace_init) {
@@ -143,6 +149,7 @@ i386_init(void) {
 
     /* Lab 6 memory management initialization functions */
     init_memory();
+    kmalloc_init();
 
     pic_init();
     timers_init();
@@ -154,6 +161,7 @@ i386_init(void) {
 
     /* User environment initialization functions */
     env_init();
+    ktimer_init();
 
     /* Choose the timer used for scheduling: hpet or pit */
     timers_schedule("hpet0");
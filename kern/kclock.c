@@ -49,6 +49,9 @@ static void
 rtc_timer_pic_interrupt(void) {
     // LAB 4: Your code here
     // Enable PIC interrupts.
+    /* Acknowledge an interrupt that may have come while it was masked,
+     * the RTC doesn't raise new ones until then */
+    rtc_check_status();
     pic_irq_unmask(IRQ_CLOCK);
 }
 
@@ -58,11 +61,19 @@ rtc_timer_pic_handle(void) {
     pic_send_eoi(IRQ_CLOCK);
 }
 
+/* The RTC periodic interrupt can't be programmed for an arbitrary
+ * deadline, so keep ticking if there is one and stop otherwise */
+static void
+rtc_timer_oneshot(uint64_t ns) {
+    if (!ns) pic_irq_mask(IRQ_CLOCK);
+}
+
 struct Timer timer_rtc = {
         .timer_name = "rtc",
         .timer_init = rtc_timer_init,
         .enable_interrupts = rtc_timer_pic_interrupt,
         .handle_interrupts = rtc_timer_pic_handle,
+        .set_oneshot = rtc_timer_oneshot,
 };
 
 static int
@@ -97,8 +97,7 @@ debuginfo_rip(uintptr_t addr, struct Ripdebuginfo *info) {
      * Make sure that you fully understand why it is necessary. */
 
     // LAB 8: Your code here:
-    uintptr_t old_cr3 = curenv->address_space.cr3;
-    if (old_cr3 != kspace.cr3) lcr3(kspace.cr3);
+    struct AddressSpace *old = current_space ? switch_address_space(&kspace) : NULL;
 
     /* Load dwarf section pointers from either
      * currently running program binary or use
@@ -146,6 +145,7 @@ debuginfo_rip(uintptr_t addr, struct Ripdebuginfo *info) {
     info->rip_fn_namelen = strnlen(info->rip_fn_name, sizeof(info->rip_fn_name) / sizeof(info->rip_fn_name[0]));
 
 error:
+    if (old) switch_address_space(old);
     return res;
 }
 
@@ -0,0 +1,396 @@
+/* Slab allocator for small kernel objects on top of page allocator.
+ *
+ * Every cache hands out objects of one size from slabs, which are single
+ * 4K pages starting with struct Slab. Slabs are kept on partial, full and
+ * empty lists of their cache; at most one empty slab is retained.
+ * Free objects are tracked by an index stack in the slab header rather
+ * than by links inside objects, so objects stay in the state their
+ * constructor left them in between kmem_cache_free() and the next
+ * kmem_cache_alloc().
+ *
+ * kmalloc() serves requests up to KMALLOC_MAX_SLAB bytes from power
+ * of two caches, larger ones get their own page class with
+ * a small header in front. */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/kmalloc.h>
+#include <kern/pmap.h>
+#include <kern/vsyscall.h>
+
+#define SLAB_MAGIC  0x51AB51ABU
+#define LARGE_MAGIC 0x1A26E0B7U
+
+#define KMEM_ALIGN       16
+#define KMEM_MAX_CACHES  32
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SLAB 1024
+#define NKMALLOC         7 /* log2(KMALLOC_MAX_SLAB / KMALLOC_MIN_SIZE) + 1 */
+
+#ifdef SANITIZE_SHADOW_BASE
+/* Poisoned gap after every object */
+#define KMEM_REDZONE 16
+#else
+#define KMEM_REDZONE 0
+#endif
+
+struct KmemCache {
+    const char *name;
+    size_t objsize;       /* Requested object size */
+    size_t stride;        /* Distance between objects, includes redzone */
+    size_t nobj;          /* Objects per slab */
+    size_t offset;        /* Offset of the first object in slab */
+    void (*ctor)(void *); /* Called once for each object of new slab */
+    struct List partial, full, empty;
+    size_t nslabs;   /* Slabs owned by cache */
+    size_t inuse;    /* Allocated objects */
+    uint64_t allocs; /* Total kmem_cache_alloc() calls */
+    uint64_t frees;  /* Total kmem_cache_free() calls */
+};
+
+struct Slab {
+    uint32_t magic;
+    uint16_t inuse;          /* Allocated objects */
+    uint16_t nfree;          /* Valid entries of free[] */
+    struct List link;        /* Link in one of cache lists (first field after header) */
+    struct KmemCache *cache; /* Owner */
+    uint8_t free[];          /* Stack of indices of free objects */
+};
+
+struct LargeHeader {
+    uint32_t magic;
+    int class;
+} __attribute__((aligned(KMEM_ALIGN)));
+
+static struct KmemCache caches[KMEM_MAX_CACHES];
+static size_t ncaches;
+static struct KmemCache *kmalloc_caches[NKMALLOC];
+static const char *kmalloc_names[NKMALLOC] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+/* Large allocations statistics */
+static uint64_t large_allocs, large_frees, large_bytes;
+
+#define LINK2SLAB(l) ((struct Slab *)((uint8_t *)(l)-offsetof(struct Slab, link)))
+
+static void
+slab_list_move(struct Slab *slab, struct List *list) {
+    struct List *link = &slab->link;
+    if (link->next) {
+        link->next->prev = link->prev;
+        link->prev->next = link->next;
+    }
+    link->next = list->next;
+    link->prev = list;
+    list->next->prev = link;
+    list->next = link;
+}
+
+static void
+slab_list_del(struct Slab *slab) {
+    slab->link.next->prev = slab->link.prev;
+    slab->link.prev->next = slab->link.next;
+    slab->link.next = slab->link.prev = NULL;
+}
+
+inline static void *
+slab_obj(struct KmemCache *cache, struct Slab *slab, size_t idx) {
+    return (uint8_t *)slab + cache->offset + idx * cache->stride;
+}
+
+inline static void
+kmem_poison(void *obj, size_t size) {
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_poison(obj, size);
+#endif
+    (void)obj, (void)size;
+}
+
+inline static void
+kmem_unpoison(void *obj, size_t size) {
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(obj, size);
+#endif
+    (void)obj, (void)size;
+}
+
+static struct Slab *
+slab_create(struct KmemCache *cache) {
+    struct Slab *slab = kpage_alloc(0);
+    if (!slab) return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->nfree = cache->nobj;
+    slab->cache = cache;
+    slab->link.next = slab->link.prev = NULL;
+
+    /* Objects are popped from the end of stack,
+     * so hand out lower addresses first */
+    for (size_t i = 0; i < cache->nobj; i++) {
+        slab->free[i] = cache->nobj - 1 - i;
+        if (cache->ctor) cache->ctor(slab_obj(cache, slab, i));
+    }
+    kmem_poison((uint8_t *)slab + cache->offset, cache->nobj * cache->stride);
+
+    cache->nslabs++;
+    return slab;
+}
+
+static void
+slab_destroy(struct KmemCache *cache, struct Slab *slab) {
+    assert(!slab->inuse);
+    slab_list_del(slab);
+    slab->magic = 0;
+    cache->nslabs--;
+    kmem_unpoison((uint8_t *)slab + cache->offset, cache->nobj * cache->stride);
+    kpage_free(slab, 0);
+}
+
+static void
+cache_init(struct KmemCache *cache, const char *name, size_t size, void (*ctor)(void *)) {
+    cache->name = name;
+    cache->objsize = size;
+    cache->stride = ROUNDUP(MAX(size, 1) + KMEM_REDZONE, KMEM_ALIGN);
+    cache->ctor = ctor;
+
+    size_t nobj = (PAGE_SIZE - sizeof(struct Slab)) / (cache->stride + 1);
+    while (ROUNDUP(sizeof(struct Slab) + nobj, KMEM_ALIGN) + nobj * cache->stride > PAGE_SIZE) nobj--;
+    assert(nobj > 0 && nobj <= 256);
+    cache->nobj = nobj;
+    cache->offset = ROUNDUP(sizeof(struct Slab) + nobj, KMEM_ALIGN);
+
+    cache->partial.next = cache->partial.prev = &cache->partial;
+    cache->full.next = cache->full.prev = &cache->full;
+    cache->empty.next = cache->empty.prev = &cache->empty;
+}
+
+/*
+ * Creates cache of objects of 'size' bytes.
+ * 'ctor' (can be NULL) is applied to every object once, when the
+ * slab containing it is created, objects should be returned to
+ * the cache in constructed state.
+ * Returns NULL if there's no free cache slot or objects are
+ * too big to be put into a single page slab
+ */
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *)) {
+    if (ncaches >= KMEM_MAX_CACHES) return NULL;
+    if (ROUNDUP(size + KMEM_REDZONE, KMEM_ALIGN) + KMEM_ALIGN + sizeof(struct Slab) > PAGE_SIZE) return NULL;
+
+    struct KmemCache *cache = &caches[ncaches++];
+    cache_init(cache, name, size, ctor);
+    return cache;
+}
+
+void *
+kmem_cache_alloc(struct KmemCache *cache) {
+    struct Slab *slab;
+
+    if (cache->partial.next != &cache->partial) {
+        slab = LINK2SLAB(cache->partial.next);
+    } else if (cache->empty.next != &cache->empty) {
+        slab = LINK2SLAB(cache->empty.next);
+        slab_list_move(slab, &cache->partial);
+    } else {
+        if (!(slab = slab_create(cache))) return NULL;
+        slab_list_move(slab, &cache->partial);
+    }
+
+    assert(slab->magic == SLAB_MAGIC && slab->nfree);
+    void *obj = slab_obj(cache, slab, slab->free[--slab->nfree]);
+    slab->inuse++;
+    if (!slab->nfree) slab_list_move(slab, &cache->full);
+
+    cache->inuse++;
+    cache->allocs++;
+
+    kmem_unpoison(obj, cache->objsize);
+    return obj;
+}
+
+void
+kmem_cache_free(struct KmemCache *cache, void *obj) {
+    struct Slab *slab = ROUNDDOWN(obj, PAGE_SIZE);
+    assert(slab->magic == SLAB_MAGIC && slab->cache == cache);
+
+    size_t off = (uint8_t *)obj - (uint8_t *)slab - cache->offset;
+    size_t idx = off / cache->stride;
+    if (off % cache->stride || idx >= cache->nobj || !slab->inuse)
+        panic("kmem_cache_free: bad pointer %p for cache %s", obj, cache->name);
+
+    kmem_poison(obj, cache->stride);
+
+    bool was_full = !slab->nfree;
+    slab->free[slab->nfree++] = idx;
+    slab->inuse--;
+    cache->inuse--;
+    cache->frees++;
+
+    if (!slab->inuse) {
+        /* Keep a single empty slab to avoid thrashing */
+        if (cache->empty.next != &cache->empty)
+            slab_destroy(cache, slab);
+        else
+            slab_list_move(slab, &cache->empty);
+    } else if (was_full) {
+        slab_list_move(slab, &cache->partial);
+    }
+}
+
+void
+kmalloc_init(void) {
+    for (size_t i = 0; i < NKMALLOC; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], KMALLOC_MIN_SIZE << i, NULL);
+        assert(kmalloc_caches[i]);
+    }
+}
+
+void *
+kmalloc(size_t size) {
+    if (size <= KMALLOC_MAX_SLAB) {
+        size_t i = 0;
+        while ((size_t)KMALLOC_MIN_SIZE << i < size) i++;
+        return kmem_cache_alloc(kmalloc_caches[i]);
+    }
+
+    int class = 0;
+    while (CLASS_SIZE(class) < size + sizeof(struct LargeHeader)) class++;
+
+    struct LargeHeader *hdr = kpage_alloc(class);
+    if (!hdr) return NULL;
+    hdr->magic = LARGE_MAGIC;
+    hdr->class = class;
+
+    large_allocs++;
+    large_bytes += CLASS_SIZE(class);
+    return hdr + 1;
+}
+
+void *
+kzalloc(size_t size) {
+    void *res = kmalloc(size);
+    if (res) memset(res, 0, size);
+    return res;
+}
+
+void
+kfree(void *ptr) {
+    if (!ptr) return;
+
+    /* Both slab and large allocation header are at
+     * the beginning of the first page of allocation */
+    uint32_t magic = *(uint32_t *)ROUNDDOWN(ptr, PAGE_SIZE);
+    if (magic == SLAB_MAGIC) {
+        struct Slab *slab = ROUNDDOWN(ptr, PAGE_SIZE);
+        kmem_cache_free(slab->cache, ptr);
+    } else {
+        struct LargeHeader *hdr = (struct LargeHeader *)ptr - 1;
+        if (magic != LARGE_MAGIC || (void *)hdr != ROUNDDOWN(ptr, PAGE_SIZE))
+            panic("kfree: bad pointer %p", ptr);
+        hdr->magic = 0;
+        large_frees++;
+        large_bytes -= CLASS_SIZE(hdr->class);
+        kpage_free(hdr, hdr->class);
+    }
+}
+
+void
+dump_kmalloc_stats(void) {
+    cprintf("CACHE          OBJSIZE  SLABS   INUSE/TOTAL     ALLOCS      FREES\n");
+    for (size_t i = 0; i < ncaches; i++) {
+        struct KmemCache *cache = &caches[i];
+        cprintf("%-14s %7zu %6zu %7zu/%-7zu %10lu %10lu\n",
+                cache->name, cache->objsize, cache->nslabs,
+                cache->inuse, cache->nslabs * cache->nobj,
+                (unsigned long)cache->allocs, (unsigned long)cache->frees);
+    }
+    cprintf("large: %lu allocs, %lu frees, %lu KB in use\n",
+            (unsigned long)large_allocs, (unsigned long)large_frees, (unsigned long)(large_bytes / 1024));
+}
+
+#define TEST_SLOTS  512
+#define TEST_ROUNDS 200000
+#define TEST_PAIRS  100000
+
+#define TEST_CTOR_MAGIC 0xC0FFEE
+
+static void
+test_ctor(void *obj) {
+    *(uint32_t *)obj = TEST_CTOR_MAGIC;
+}
+
+/*
+ * Stress test (random sizes and lifetimes with content checks),
+ * constructor test and alloc/free throughput compared with
+ * allocating whole pages
+ */
+void
+kmalloc_selftest(void) {
+    static uint8_t *slots[TEST_SLOTS];
+    static size_t sizes[TEST_SLOTS];
+    uint64_t seed = 1;
+    size_t inuse[NKMALLOC];
+
+    for (size_t i = 0; i < NKMALLOC; i++)
+        inuse[i] = kmalloc_caches[i]->inuse;
+
+    for (size_t round = 0; round < TEST_ROUNDS; round++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t i = (seed >> 33) % TEST_SLOTS;
+
+        if (slots[i]) {
+            for (size_t j = 0; j < sizes[i]; j++)
+                if (slots[i][j] != (uint8_t)(i + j)) panic("kmalloc_selftest: corrupted object %p", slots[i]);
+            kfree(slots[i]);
+            slots[i] = NULL;
+        } else {
+            /* Mostly small objects, sometimes large ones */
+            size_t size = (seed >> 20) % 16 ? (seed >> 40) % (KMALLOC_MAX_SLAB + 1) : (seed >> 40) % (4 * PAGE_SIZE);
+            if (!(slots[i] = kmalloc(size))) panic("kmalloc_selftest: out of memory");
+            assert(!((uintptr_t)slots[i] & (KMEM_ALIGN - 1)));
+            sizes[i] = size;
+            for (size_t j = 0; j < size; j++)
+                slots[i][j] = i + j;
+        }
+    }
+
+    for (size_t i = 0; i < TEST_SLOTS; i++) {
+        kfree(slots[i]);
+        slots[i] = NULL;
+    }
+    for (size_t i = 0; i < NKMALLOC; i++)
+        assert(kmalloc_caches[i]->inuse == inuse[i]);
+    cprintf("kmalloc_selftest: stress test passed\n");
+
+    static struct KmemCache *ctor_cache;
+    if (!ctor_cache) ctor_cache = kmem_cache_create("selftest-ctor", 48, test_ctor);
+    assert(ctor_cache);
+    uint32_t *obj = kmem_cache_alloc(ctor_cache);
+    assert(obj && *obj == TEST_CTOR_MAGIC);
+    kmem_cache_free(ctor_cache, obj);
+    obj = kmem_cache_alloc(ctor_cache);
+    assert(*obj == TEST_CTOR_MAGIC);
+    kmem_cache_free(ctor_cache, obj);
+    cprintf("kmalloc_selftest: constructor test passed\n");
+
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < TEST_PAIRS; i++)
+        kfree(kmalloc(64));
+    uint64_t slab_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < TEST_PAIRS; i++)
+        kpage_free(kpage_alloc(0), 0);
+    uint64_t page_cycles = read_tsc() - start;
+
+    cprintf("kmalloc_selftest: kmalloc(64)/kfree: %lu cycles per pair, %lu us total\n",
+            (unsigned long)(slab_cycles / TEST_PAIRS), (unsigned long)tsc2us(slab_cycles, vsys->vsys_tsc_freq));
+    cprintf("kmalloc_selftest: 4K page alloc/free: %lu cycles per pair, %lu us total\n",
+            (unsigned long)(page_cycles / TEST_PAIRS), (unsigned long)tsc2us(page_cycles, vsys->vsys_tsc_freq));
+}
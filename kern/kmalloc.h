@@ -0,0 +1,23 @@
+#ifndef JOS_KERN_KMALLOC_H
+#define JOS_KERN_KMALLOC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct KmemCache;
+
+struct KmemCache *kmem_cache_create(const char *name, size_t size, void (*ctor)(void *));
+void *kmem_cache_alloc(struct KmemCache *cache);
+void kmem_cache_free(struct KmemCache *cache, void *obj);
+
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *ptr);
+
+void kmalloc_init(void);
+void dump_kmalloc_stats(void);
+void kmalloc_selftest(void);
+
+#endif
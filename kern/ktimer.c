@@ -0,0 +1,145 @@
+/* Sleeping environments, kept in a hashed timer wheel.
+ *
+ * Time is measured in nanoseconds since boot (see ktimer_now()) and cut
+ * into ticks of 2^KTIMER_TICK_SHIFT ns.  An env sleeping until 'deadline'
+ * is linked into slot (deadline >> KTIMER_TICK_SHIFT) % KTIMER_NSLOTS,
+ * so adding and cancelling a sleep is O(1) and expiring only looks at the
+ * slots of the ticks that passed since the last check.  Deadlines more
+ * than one wheel rotation away just stay in their slot for a later round.
+ *
+ * The wheel is advanced from sched_yield(), i.e. on every scheduling
+ * timer interrupt and every yield, and an idle CPU programs its one-shot
+ * timer for the first occupied slot (see sched_halt()). */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/ktimer.h>
+#include <kern/sched.h>
+#include <kern/vsyscall.h>
+
+#define KTIMER_TICK_SHIFT 20 /* ~1ms */
+#define KTIMER_NSLOTS     512
+
+static struct List wheel[KTIMER_NSLOTS];
+static uint64_t wheel_tick; /* Last tick expired */
+static size_t nsleeping;
+
+static inline struct Env *
+sleep_env(struct List *link) {
+    return (struct Env *)((uint8_t *)link - offsetof(struct Env, env_sleep_link));
+}
+
+void
+ktimer_init(void) {
+    for (size_t i = 0; i < KTIMER_NSLOTS; i++)
+        wheel[i].next = wheel[i].prev = &wheel[i];
+    wheel_tick = ktimer_now() >> KTIMER_TICK_SHIFT;
+}
+
+/* Nanoseconds since boot */
+uint64_t
+ktimer_now(void) {
+    return tsc2ns(read_tsc() - vsys->vsys_tsc_base, vsys->vsys_tsc_freq);
+}
+
+/* Put env to sleep until 'deadline'.  The caller is responsible
+ * for making env not runnable, ktimer_expire() makes it runnable. */
+void
+ktimer_sleep(struct Env *env, uint64_t deadline) {
+    ktimer_cancel(env);
+
+    struct List *slot = &wheel[(deadline >> KTIMER_TICK_SHIFT) % KTIMER_NSLOTS];
+    struct List *link = &env->env_sleep_link;
+    env->env_sleep_deadline = deadline;
+    link->next = slot;
+    link->prev = slot->prev;
+    slot->prev->next = link;
+    slot->prev = link;
+    nsleeping++;
+}
+
+/* Remove env from the wheel, does nothing if it's not sleeping */
+void
+ktimer_cancel(struct Env *env) {
+    struct List *link = &env->env_sleep_link;
+    if (!link->next) return;
+
+    link->next->prev = link->prev;
+    link->prev->next = link->next;
+    link->next = link->prev = NULL;
+    nsleeping--;
+}
+
+/* Wake up env whose deadline has passed.
+ * An env blocked in sys_ipc_recv() gets -E_TIMEOUT. */
+static void
+ktimer_wakeup(struct Env *env) {
+    ktimer_cancel(env);
+
+    if (env->env_ipc_recving) {
+        env->env_ipc_recving = 0;
+        env->env_tf.tf_regs.reg_rax = -E_TIMEOUT;
+    }
+
+    if (env->env_status == ENV_NOT_RUNNABLE) {
+        env->env_status = ENV_RUNNABLE;
+        sched_enqueue(env);
+    }
+}
+
+/* Wake up all envs whose deadline has passed */
+void
+ktimer_expire(void) {
+    if (!nsleeping) return;
+
+    uint64_t now = ktimer_now();
+    uint64_t tick = now >> KTIMER_TICK_SHIFT;
+    uint64_t first = wheel_tick;
+
+    /* Every slot has to be looked at once at most */
+    if (tick - first >= KTIMER_NSLOTS) first = tick - KTIMER_NSLOTS + 1;
+
+    for (uint64_t t = first; t <= tick; t++) {
+        struct List *slot = &wheel[t % KTIMER_NSLOTS];
+        struct List *link = slot->next;
+        while (link != slot) {
+            struct Env *env = sleep_env(link);
+            link = link->next;
+            if (env->env_sleep_deadline <= now) ktimer_wakeup(env);
+        }
+    }
+
+    wheel_tick = tick;
+}
+
+/* Nanoseconds until the next sleeping env may need to wake up,
+ * at least 1, or 0 if no env is sleeping */
+uint64_t
+ktimer_next(void) {
+    if (!nsleeping) return 0;
+
+    uint64_t now = ktimer_now();
+    for (uint64_t t = wheel_tick; t < wheel_tick + KTIMER_NSLOTS; t++) {
+        struct List *slot = &wheel[t % KTIMER_NSLOTS];
+        uint64_t next = 0;
+
+        for (struct List *link = slot->next; link != slot; link = link->next) {
+            uint64_t deadline = sleep_env(link)->env_sleep_deadline;
+            if (deadline >> KTIMER_TICK_SHIFT == t && (!next || deadline < next)) next = deadline;
+        }
+
+        if (next) return next > now ? next - now : 1;
+    }
+
+    /* Only sleepers beyond one rotation, come back to look again */
+    return (uint64_t)KTIMER_NSLOTS << KTIMER_TICK_SHIFT;
+}
+
+/* Whether any env is sleeping */
+bool
+ktimer_pending(void) {
+    return nsleeping;
+}
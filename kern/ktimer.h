@@ -0,0 +1,21 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KTIMER_H
+#define JOS_KERN_KTIMER_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+void ktimer_init(void);
+uint64_t ktimer_now(void);
+void ktimer_sleep(struct Env *env, uint64_t deadline);
+void ktimer_cancel(struct Env *env);
+void ktimer_expire(void);
+uint64_t ktimer_next(void);
+bool ktimer_pending(void);
+
+#endif /* !JOS_KERN_KTIMER_H */
@@ -9,6 +9,7 @@
 #include <inc/x86.h>
 
 #include <kern/console.h>
+#include <kern/cpufeature.h>
 #include <kern/monitor.h>
 #include <kern/kclock.h>
 #include <kern/kdebug.h>
@@ -16,7 +17,9 @@
 #include <kern/timer.h>
 #include <kern/env.h>
 #include <kern/pmap.h>
+#include <kern/kmalloc.h>
 #include <kern/trap.h>
+#include <kern/vsyscall.h>
 
 #define WHITESPACE "\t\r\n "
 #define MAXARGS    16
@@ -30,8 +33,13 @@ int mon_start(int argc, char **argv, struct Trapframe *tf);
 int mon_stop(int argc, char **argv, struct Trapframe *tf);
 int mon_frequency(int argc, char **argv, struct Trapframe *tf);
 int mon_memory(int argc, char **argv, struct Trapframe *tf);
+int mon_allocbench(int argc, char **argv, struct Trapframe *tf);
+int mon_promote(int argc, char **argv, struct Trapframe *tf);
+int mon_cpuinfo(int argc, char **argv, struct Trapframe *tf);
+int mon_kmalloc(int argc, char **argv, struct Trapframe *tf);
 int mon_pagetable(int argc, char **argv, struct Trapframe *tf);
 int mon_virt(int argc, char **argv, struct Trapframe *tf);
+int mon_top(int argc, char **argv, struct Trapframe *tf);
 
 struct Command {
     const char *name;
@@ -48,9 +56,14 @@ static struct Command commands[] = {
         {"timer_start", "Start timer", mon_start},
         {"timer_stop", "Stop timer", mon_stop},
         {"timer_freq", "Get timer frequency", mon_frequency},
-        {"memory", "Display allocated memory pages", mon_memory},
+        {"memory", "Display free memory lists and allocator statistics", mon_memory},
+        {"allocbench", "Time physical page allocator [count]", mon_allocbench},
+        {"promote", "Promote user memory to 2MB pages", mon_promote},
+        {"cpuinfo", "Display detected CPU features and chosen routine variants", mon_cpuinfo},
+        {"kmalloc", "Display slab allocator statistics, 'kmalloc test' runs self-test", mon_kmalloc},
         {"pagetable", "Display current page table", mon_pagetable},
         {"virt", "Display virtual memory tree", mon_virt},
+        {"top", "Display per-environment CPU usage", mon_top},
 };
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
@@ -148,7 +161,61 @@ mon_frequency(int argc, char **argv, struct Trapframe *tf) {
 /* Implement memory (mon_memory) commands. */
 int
 mon_memory(int argc, char **argv, struct Trapframe *tf) {
+    if (argc == 5 && !strcmp(argv[1], "zeropool")) {
+        int res = zero_pool_set_watermarks(strtol(argv[2], NULL, 0),
+                                           strtol(argv[3], NULL, 0), strtol(argv[4], NULL, 0));
+        if (res < 0) cprintf("memory: %i\n", res);
+        return 0;
+    } else if (argc == 3 && !strcmp(argv[1], "cowsplit")) {
+        int res = cow_set_split_class(strtol(argv[2], NULL, 0));
+        if (res < 0) cprintf("memory: %i\n", res);
+        return 0;
+    } else if (argc == 2 && !strcmp(argv[1], "reclaim")) {
+        cprintf("before:\n");
+        dump_memory_stats();
+        size_t pts = pt_cache_drain();
+        size_t pools = pool_reclaim();
+        cprintf("reclaimed %zu descriptor pools, %zu page table pages\nafter:\n", pools, pts);
+        dump_memory_stats();
+        return 0;
+    } else if (argc > 1) {
+        cprintf("Usage: memory [zeropool <class> <low> <high> | cowsplit <class> | reclaim]\n");
+        return 0;
+    }
+
     dump_memory_lists();
+    dump_memory_stats();
+    return 0;
+}
+
+int
+mon_cpuinfo(int argc, char **argv, struct Trapframe *tf) {
+    dump_cpu_features();
+    return 0;
+}
+
+int
+mon_kmalloc(int argc, char **argv, struct Trapframe *tf) {
+    if (argc > 1 && !strcmp(argv[1], "test")) kmalloc_selftest();
+    dump_kmalloc_stats();
+    return 0;
+}
+
+int
+mon_promote(int argc, char **argv, struct Trapframe *tf) {
+    for (size_t i = 0; i < NENV; i++) {
+        if (envs[i].env_status == ENV_FREE || envs[i].env_status == ENV_DYING) continue;
+        int res = huge_promote(&envs[i].address_space);
+        if (res) cprintf("%08x: %i\n", envs[i].env_id, res);
+    }
+    return 0;
+}
+
+int
+mon_allocbench(int argc, char **argv, struct Trapframe *tf) {
+    size_t count = argc > 1 ? strtol(argv[1], NULL, 0) : 100000;
+    if (!count) count = 1;
+    alloc_bench(count);
     return 0;
 }
 
@@ -191,6 +258,56 @@ mon_dumpcmos(int argc, char **argv, struct Trapframe *tf) {
     return 0;
 }
 
+static uint64_t
+env_cputime(struct Env *env) {
+    return vsys->vsys_runtime[env - envs];
+}
+
+/* Kernel time is whatever part of the runtime was not spent in user mode */
+static uint64_t
+env_kerntime(struct Env *env) {
+    uint64_t cputime = env_cputime(env);
+    return cputime > env->env_acct.acct_utime ? cputime - env->env_acct.acct_utime : 0;
+}
+
+/* Print live environments sorted by the CPU time they used */
+int
+mon_top(int argc, char **argv, struct Trapframe *tf) {
+    static struct Env *sorted[NENV];
+    static const char *state[] = {"FREE", "DYING", "RUNNABLE", "RUNNING", "BLOCKED"};
+    uint64_t total = 0, msec = vsys->vsys_tsc_freq / 1000;
+    size_t n = 0;
+
+    if (!msec) msec = 1;
+    env_charge_runtime();
+
+    /* Insertion sort, there are few live envs */
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status == ENV_FREE) continue;
+
+        total += env_cputime(env);
+        size_t j = n++;
+        for (; j > 0 && env_cputime(sorted[j - 1]) < env_cputime(env); j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = env;
+    }
+
+    cprintf("   ENVID STATUS    CPU%%  USER(ms)  KERN(ms)  SWITCH  PF-KERN  PF-USER  IPC-SND  IPC-RCV\n");
+    for (size_t i = 0; i < n; i++) {
+        struct Env *env = sorted[i];
+        struct EnvAcct *acct = &env->env_acct;
+        cprintf("%08x %-8s %4lu %9lu %9lu %7u %8u %8u %8u %8u\n",
+                env->env_id, state[env->env_status],
+                (unsigned long)(total ? env_cputime(env) * 100 / total : 0),
+                (unsigned long)(acct->acct_utime / msec), (unsigned long)(env_kerntime(env) / msec),
+                acct->acct_switches, acct->acct_pgfault_kern, acct->acct_pgfault_user,
+                acct->acct_ipc_sends, acct->acct_ipc_recvs);
+    }
+
+    return 0;
+}
+
 /* Kernel monitor command interpreter */
 
 static int
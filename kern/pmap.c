@@ -7,11 +7,13 @@
 #include <inc/uefi.h>
 #include <inc/x86.h>
 
+#include <kern/cpufeature.h>
 #include <kern/env.h>
 #include <kern/kclock.h>
 #include <kern/pmap.h>
 #include <kern/traceopt.h>
 #include <kern/trap.h>
+#include <kern/vsyscall.h>
 
 /*
  * Term "page" used here does not
@@ -21,8 +23,20 @@
  * by struct Page
  */
 
+/* Free lists are split into zones so that allocations
+ * restricted to [0; BOOT_MEM_SIZE) never walk high memory */
+enum {
+    ZONE_BOOT, /* Free pages starting below BOOT_MEM_SIZE */
+    ZONE_HIGH, /* Everything else */
+    NZONES,
+};
+
 /* for O(1) page allocation */
-static struct List free_classes[MAX_CLASS];
+static struct List free_classes[NZONES][MAX_CLASS];
+/* Bit N set if free_classes[zone][N] might be non-empty.
+ * Bits are set eagerly on insertion and cleared lazily
+ * by free_list_find(), so a clear bit always means empty list */
+static uint64_t free_class_map[NZONES];
 /* List of descriptor pools */
 static struct PagePool *first_pool;
 /* List of free descriptors */
@@ -36,15 +50,21 @@ struct AddressSpace kspace;
 struct AddressSpace *current_space;
 /* Root node of physical memory tree */
 struct Page root;
+/* Physical pages filled with 0x00 and 0xFF */
+static struct Page *zero_page, *one_page;
 /* Top address for page pools mappings */
 static uintptr_t metaheaptop;
 
-// TODO Test these properly via cpuid
+/* Address spaces are tagged with PCIDs so that
+ * switching between them does not flush the TLB */
+static bool pcid_supported;
+/* Allocated PCIDs, PCID 0 belongs to kspace */
+static uint64_t pcid_map[NPCID / 64] = {1};
 
 /* Not-executable bit supported by page tables */
-static bool nx_supported = 1;
+static bool nx_supported;
 /* 1GB pages are supported */
-static bool has_1gb_pages = 1;
+static bool has_1gb_pages;
 
 /* Kernel executable end virtual address */
 extern char end[];
@@ -56,6 +76,8 @@ extern char pfstacktop[], pfstack[];
 #define ALLOC_WEAK 0x20000
 /* Allocate page within [0; BOOT_MEM_SIZE) */
 #define ALLOC_BOOTMEM 0x40000
+/* Allocate page outside of [0; BOOT_MEM_SIZE) and don't reclaim caches */
+#define ALLOC_HIGHMEM 0x80000
 
 /* Descriptor pool page size */
 #define POOL_CLASS 1
@@ -69,6 +91,9 @@ extern char pfstacktop[], pfstack[];
 
 #define INIT_DESCR 256
 
+/* Statically allocated descriptors used before the first pool */
+static struct Page initial_buffer[INIT_DESCR];
+
 #define ABSDIFF(x, y) ((x) > (y) ? (x) - (y) : (y) - (x))
 
 #define assert_physical(n) ({ if (trace_memory_more) _assert_root(__FILE__, __LINE__, n, 1); assert(((n)->state & NODE_TYPE_MASK) >= PARTIAL_NODE); })
@@ -112,6 +137,20 @@ list_del(struct List *list) {
 
 static struct Page *alloc_page(int class, int flags);
 
+/* Descriptor pool statistics */
+static struct {
+    size_t count;     /* Pools currently allocated */
+    size_t reclaimed; /* Pools returned to free lists in total */
+} pool_stats;
+
+/* Pool containing descriptor or NULL for initial buffer.
+ * Pools are naturally aligned POOL_CLASS pages */
+inline static struct PagePool *
+desc_pool(struct Page *page) {
+    if (page >= initial_buffer && page < initial_buffer + INIT_DESCR) return NULL;
+    return (struct PagePool *)ROUNDDOWN((uintptr_t)page, CLASS_SIZE(POOL_CLASS));
+}
+
 void
 ensure_free_desc(size_t count) {
     if (free_desc_count < count) {
@@ -135,6 +174,9 @@ alloc_descriptor(enum PageState state) {
     new->state = state;
     free_desc_count--;
 
+    struct PagePool *pool = desc_pool(new);
+    if (pool) pool->live++;
+
     return new;
 }
 
@@ -143,6 +185,12 @@ free_descriptor(struct Page *page) {
     list_del((struct List *)page);
     list_append(&free_descriptors, (struct List *)page);
     free_desc_count++;
+
+    struct PagePool *pool = desc_pool(page);
+    if (pool) {
+        assert(pool->live);
+        pool->live--;
+    }
 }
 
 static void
@@ -152,6 +200,52 @@ _assert_root(const char *file, int line, struct Page *p, bool phy) {
         _panic(file, line, "Page %p (phy %p) should%s be physical\n", p, (void *)PADDR(p), phy ? "" : "n't");
 }
 
+inline static int __attribute__((always_inline))
+page_zone(struct Page *page) {
+    return page2pa(page) < BOOT_MEM_SIZE ? ZONE_BOOT : ZONE_HIGH;
+}
+
+/*
+ * Puts free allocatable page to the free list
+ * of its zone and class
+ */
+inline static void __attribute__((always_inline))
+free_list_add(struct Page *page) {
+    int zone = page_zone(page);
+    list_append(&free_classes[zone][page->class], (struct List *)page);
+    free_class_map[zone] |= 1ULL << page->class;
+}
+
+/*
+ * Finds first free page of class not less than 'class' in 'zone'.
+ * If 'bootmem' is set, only pages which lower CLASS_SIZE(class)
+ * bytes are within BOOT_MEM_SIZE are suitable.
+ */
+static struct Page *
+free_list_find(int zone, int class, bool bootmem) {
+    uint64_t map = free_class_map[zone] & ~((1ULL << class) - 1);
+
+    while (map) {
+        int pclass = __builtin_ctzll(map);
+        struct List *head = &free_classes[zone][pclass];
+        map &= map - 1;
+
+        if (list_empty(head)) {
+            free_class_map[zone] &= ~(1ULL << pclass);
+            continue;
+        }
+
+        for (struct List *li = head->next; li != head; li = li->next) {
+            struct Page *peer = (struct Page *)li;
+            assert(peer->state == ALLOCATABLE_NODE);
+            assert_physical(peer);
+            if (!bootmem || page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) return peer;
+        }
+    }
+
+    return NULL;
+}
+
 static void
 free_desc_rec(struct Page *p) {
     while (p) {
@@ -240,7 +334,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
                 struct Page *other = !right ? node->right : node->left;
                 assert(other->state == ALLOCATABLE_NODE);
                 list_del((struct List *)node);
-                list_append(&free_classes[node->class - 1], (struct List *)other);
+                free_list_add(other);
             }
 
             if (type != PARTIAL_NODE && node->state != type)
@@ -265,7 +359,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
 
         /* We cannot change RESERVED_NODE memory to ALLOCATABLE_NODE */
         if (type != PARTIAL_NODE && node->state != RESERVED_NODE) node->state = type;
-        if (node->state == ALLOCATABLE_NODE) list_append(&free_classes[node->class], (struct List *)node);
+        if (node->state == ALLOCATABLE_NODE) free_list_add(node);
 
         if (trace_memory) cprintf("Attaching page (%x) at %p class=%d\n", node->state, (void *)page2pa(node), (int)node->class);
     }
@@ -324,7 +418,7 @@ page_unref(struct Page *page) {
 
                 if (par->state == ALLOCATABLE_NODE) {
                     assert(list_empty((struct List *)par));
-                    list_append(&free_classes[par->class], (struct List *)par);
+                    free_list_add(par);
                 }
                 page = par;
             } else
@@ -332,7 +426,7 @@ page_unref(struct Page *page) {
         }
         list_del((struct List *)page);
         if (page->state == ALLOCATABLE_NODE)
-            list_append(&free_classes[page->class], (struct List *)page);
+            free_list_add(page);
 
 #if SANITIZE_SHADOW_BASE
         if (current_space) {
@@ -437,6 +531,88 @@ page_lookup_virtual(struct Page *node, uintptr_t addr, int class, int alloc) {
     return node;
 }
 
+static struct {
+    uint64_t hits, misses;
+} vcache_stats;
+
+/*
+ * Returns the cached deepest node of spc's virtual tree
+ * for addr, NULL if it is not cached. The cache is dropped
+ * whenever the tree of spc changed since it was filled.
+ */
+static struct Page *
+vcache_probe(struct AddressSpace *spc, uintptr_t addr) {
+    if (spc->vcache_gen != spc->vtree_gen) {
+        memset(spc->vcache, 0, sizeof spc->vcache);
+        spc->vcache_gen = spc->vtree_gen;
+    }
+
+    for (size_t i = 0; i < VCACHE_SIZE; i++) {
+        struct VCacheEntry *ent = &spc->vcache[i];
+        if (ent->node && ent->start <= addr && addr < ent->end) {
+            vcache_stats.hits++;
+            return ent->node;
+        }
+    }
+    vcache_stats.misses++;
+    return NULL;
+}
+
+/*
+ * Same as page_lookup_virtual(spc->root, addr, 0, LOOKUP_PRESERVE)
+ * but remembers recent results in spc->vcache. Mapping nodes are cached
+ * for their whole range, so lookups within one large page hit.
+ */
+static struct Page *
+vcache_lookup(struct AddressSpace *spc, uintptr_t addr) {
+    struct Page *node = vcache_probe(spc, addr);
+    if (node) return node;
+
+    node = page_lookup_virtual(spc->root, addr, 0, LOOKUP_PRESERVE);
+    struct VCacheEntry *ent = &spc->vcache[(addr >> CLASS_BASE) % VCACHE_SIZE];
+    size_t size = node->phy ? CLASS_SIZE(node->phy->class) : CLASS_SIZE(0);
+    ent->start = ROUNDDOWN(addr, size);
+    ent->end = ent->start + size;
+    ent->node = node;
+    return node;
+}
+
+/* Cached mapping node of exactly the class sized block at addr, or NULL */
+static struct Page *
+vcache_mapping(struct AddressSpace *spc, uintptr_t addr, int class) {
+    struct Page *node = vcache_probe(spc, addr);
+    return node && node->phy && node->phy->class == class ? node : NULL;
+}
+
+/* page_lookup_virtual() in the tree of spc, which
+ * can be changed by any mode but LOOKUP_PRESERVE */
+static struct Page *
+vtree_lookup(struct AddressSpace *spc, uintptr_t addr, int class, int alloc) {
+    if (alloc != LOOKUP_PRESERVE) spc->vtree_gen++;
+    return page_lookup_virtual(spc->root, addr, class, alloc);
+}
+
+/*
+ * Calls fn(node, base, arg) for every mapping node of the virtual tree
+ * rooted at 'node' (covering [base, base + CLASS_SIZE(class)))
+ * that intersects [start, end). Subtrees outside of the range or
+ * without mappings are skipped, so the range is visited in a single descent.
+ * Stops at and returns the first non-zero result of fn.
+ */
+static int
+walk_virtual_range(struct Page *node, uintptr_t base, int class, uintptr_t start, uintptr_t end,
+                   int (*fn)(struct Page *node, uintptr_t base, void *arg), void *arg) {
+    if (!node || base >= end || base + CLASS_MASK(class) < start) return 0;
+    assert_virtual(node);
+
+    if (node->phy) return fn(node, base, arg);
+    if (!class) return 0;
+
+    int res = walk_virtual_range(node->left, base, class - 1, start, end, fn, arg);
+    if (res) return res;
+    return walk_virtual_range(node->right, base + CLASS_SIZE(class - 1), class - 1, start, end, fn, arg);
+}
+
 static void
 attach_region(uintptr_t start, uintptr_t end, enum PageState type) {
     if (trace_memory_more)
@@ -491,6 +667,35 @@ unmap_page_remove(struct Page *node) {
     free_descriptor(node);
 }
 
+/* Cache of freed page table pages. Pages stay referenced while
+ * cached, so alloc_pt() can reuse them without a buddy tree walk */
+#define PT_CACHE_MAX 64
+
+static struct {
+    struct Page *pages[PT_CACHE_MAX];
+    size_t count;
+    uint64_t hits, misses;
+} pt_cache;
+
+/* Drops reference to page table page, keeping it in cache if possible */
+static void
+pt_page_free(struct Page *page) {
+    assert(!page->class);
+    if (page->refc == 1 && pt_cache.count < PT_CACHE_MAX)
+        pt_cache.pages[pt_cache.count++] = page;
+    else
+        page_unref(page);
+}
+
+/* Returns cached page table pages to free lists, returns their number */
+size_t
+pt_cache_drain(void) {
+    size_t drained = pt_cache.count;
+    while (pt_cache.count)
+        page_unref(pt_cache.pages[--pt_cache.count]);
+    return drained;
+}
+
 static void
 remove_pt(pte_t *pt, pte_t base, size_t step, uintptr_t i0, uintptr_t i1) {
     assert(step == 1 * GB || step == 2 * MB || step == 4 * KB || step == 512 * GB);
@@ -501,7 +706,7 @@ remove_pt(pte_t *pt, pte_t base, size_t step, uintptr_t i0, uintptr_t i1) {
         if (!(pt[i] & PTE_PS) && step > 4 * KB) {
             pte_t *pt2 = KADDR(PTE_ADDR(pt[i]));
             remove_pt(pt2, base, step / PT_ENTRY_COUNT, 0, PT_ENTRY_COUNT);
-            page_unref(page_lookup(NULL, (uintptr_t)PADDR(pt2), 0, PARTIAL_NODE, 0));
+            pt_page_free(page_lookup(NULL, (uintptr_t)PADDR(pt2), 0, PARTIAL_NODE, 0));
         }
 
         pt[i] = 0;
@@ -575,7 +780,7 @@ check_physical_tree(struct Page *page) {
         assert(page->head.next && page->head.prev);
         if (!list_empty((struct List *)page)) {
             for (struct List *n = page->head.next;
-                 n != &free_classes[page->class]; n = n->next) {
+                 n != &free_classes[page_zone(page)][page->class]; n = n->next) {
                 assert(n != &page->head);
             }
         }
@@ -651,18 +856,59 @@ dump_virtual_tree(struct Page *node, int class) {
 void
 dump_memory_lists(void) {
     // LAB 6: Your code here
-    for (int i = 0; i < MAX_CLASS; i++) {
-        struct List *cur_node = free_classes[i].next;
-
-        while (cur_node != &free_classes[i]) {
-            cprintf(":memory_lists: %016lx - %016llx (%02d class)\n", page2pa((struct Page *)cur_node),
-                    page2pa((struct Page *)cur_node) + CLASS_SIZE(i), i);
-            cur_node = cur_node->next;
+    for (int z = 0; z < NZONES; z++) {
+        for (int i = 0; i < MAX_CLASS; i++) {
+            struct List *cur_node = free_classes[z][i].next;
+
+            while (cur_node != &free_classes[z][i]) {
+                cprintf(":memory_lists: %016lx - %016llx (%02d class)\n", page2pa((struct Page *)cur_node),
+                        page2pa((struct Page *)cur_node) + CLASS_SIZE(i), i);
+                cur_node = cur_node->next;
+            }
         }
     }
 }
 
 
+/*
+ * Allocator self-test benchmark: times 'count' descriptor pool
+ * lookups (the search ensure_free_desc() performs) and 'count'
+ * allocate/free pairs of 4K pages, then verifies physical tree
+ */
+void
+alloc_bench(size_t count) {
+    uint64_t freq = vsys->vsys_tsc_freq ? vsys->vsys_tsc_freq : 1;
+
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < count; i++) {
+        if (!free_list_find(ZONE_BOOT, POOL_CLASS, 1)) {
+            cprintf("alloc_bench: no boot memory\n");
+            return;
+        }
+    }
+    uint64_t lookup = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < count; i++) {
+        struct Page *page = alloc_page(0, 0);
+        if (!page) {
+            cprintf("alloc_bench: out of memory\n");
+            return;
+        }
+        page_ref(page);
+        page_unref(page);
+    }
+    uint64_t pairs = read_tsc() - start;
+
+    check_physical_tree(&root);
+
+    cprintf("memory: %lu MB, %zu iterations\n", (unsigned long)(max_memory_map_addr / MB), count);
+    cprintf("  pool lookup:     %lu cycles/op, %lu ns/op\n",
+            (unsigned long)(lookup / count), (unsigned long)(lookup * NSEC_PER_SEC / freq / count));
+    cprintf("  alloc/free pair: %lu cycles/op, %lu ns/op\n",
+            (unsigned long)(pairs / count), (unsigned long)(pairs * NSEC_PER_SEC / freq / count));
+}
+
 /*
  * Pretty-print page table
  * You can read about the page table
@@ -719,13 +965,20 @@ dump_page_table(pte_t *pml4) {
 inline static int
 alloc_pt(pte_t *dst) {
     if (!(*dst & PTE_P) || (*dst & PTE_PS)) {
-        struct Page *page = alloc_page(0, ALLOC_BOOTMEM);
-        if (!page) return -E_NO_MEM;
+        struct Page *page;
+        if (pt_cache.count) {
+            page = pt_cache.pages[--pt_cache.count];
+            pt_cache.hits++;
+        } else {
+            page = alloc_page(0, ALLOC_BOOTMEM);
+            if (!page) return -E_NO_MEM;
 #ifdef SANITIZE_SHADOW_BASE
-        assert(page2pa(page) + CLASS_SIZE(page->class) <= BOOT_MEM_SIZE);
+            assert(page2pa(page) + CLASS_SIZE(page->class) <= BOOT_MEM_SIZE);
 #endif
-        assert(!page->refc);
-        page_ref(page);
+            assert(!page->refc);
+            page_ref(page);
+            pt_cache.misses++;
+        }
         *dst = page2pa(page) | PTE_U | PTE_W | PTE_P;
 
 #ifdef SANITIZE_SHADOW_BASE
@@ -828,11 +1081,14 @@ memcpy_page(struct AddressSpace *dst, uintptr_t va, struct Page *page) {
     switch_address_space(src);
 }
 
+/* Ranges larger than this are flushed as a whole */
+#define TLB_INVLPG_MAX (32 * PAGE_SIZE)
+
 static void
-tlb_invalidate_range(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
+tlb_invalidate_range_invlpg(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
     if (current_space == spc || !current_space) {
         /* If we need to invalidate a lot of memory, just flush whole cache */
-        if (start - end > 512 * GB)
+        if (end - start > TLB_INVLPG_MAX)
             lcr3(rcr3());
         else {
             while (start < end) {
@@ -843,18 +1099,34 @@ tlb_invalidate_range(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
     }
 }
 
+void
+tlb_invalidate_range_pcid(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
+    /* PCIDs are enabled with kernel address space */
+    if (!current_space) {
+        tlb_invalidate_range_invlpg(spc, start, end);
+        return;
+    }
+
+    /* Translations of non-current spaces survive
+     * address space switch, so they need flushing as well.
+     * Kernel part of address space is cached with every PCID */
+    if (spc == &kspace)
+        invpcid(INVPCID_ALL, 0, 0);
+    else if (end - start > TLB_INVLPG_MAX)
+        invpcid(INVPCID_SINGLE, spc->pcid, 0);
+    else {
+        for (; start < end; start += PAGE_SIZE)
+            invpcid(INVPCID_ADDRESS, spc->pcid, start);
+    }
+}
+
+/* Switched to tlb_invalidate_range_pcid() on CPUs with PCID and INVPCID */
+void (*tlb_invalidate_range)(struct AddressSpace *spc, uintptr_t start, uintptr_t end) = tlb_invalidate_range_invlpg;
+
+/* Removes page table entries of the class sized block at addr */
 static void
-unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
-    if (trace_memory) cprintf("<%p> Unmapping [%08lX, %08lX]\n",
-                              spc, addr, addr + (long)CLASS_MASK(class));
+unmap_page_pt(struct AddressSpace *spc, uintptr_t addr, int class) {
     int res;
-    assert(!(addr & CLASS_MASK(class)));
-
-    struct Page *node = page_lookup_virtual(spc->root, addr, class, LOOKUP_ALLOC);
-    if (node) unmap_page_remove(node);
-    /* Disallow root node deallocation */
-    if (node == spc->root)
-        spc->root = alloc_descriptor(INTERMEDIATE_NODE);
 
     uintptr_t end = addr + CLASS_SIZE(class);
     uintptr_t inval_start = addr, inval_end = end;
@@ -969,6 +1241,23 @@ finish:
     tlb_invalidate_range(spc, inval_start, inval_end);
 }
 
+static void
+unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
+    if (trace_memory) cprintf("<%p> Unmapping [%08lX, %08lX]\n",
+                              spc, addr, addr + (long)CLASS_MASK(class));
+    assert(!(addr & CLASS_MASK(class)));
+
+    struct Page *node = vcache_mapping(spc, addr, class);
+    if (!node) node = page_lookup_virtual(spc->root, addr, class, LOOKUP_ALLOC);
+    spc->vtree_gen++;
+    if (node) unmap_page_remove(node);
+    /* Disallow root node deallocation */
+    if (node == spc->root)
+        spc->root = alloc_descriptor(INTERMEDIATE_NODE);
+
+    unmap_page_pt(spc, addr, class);
+}
+
 static int
 map_page(struct AddressSpace *spc, uintptr_t addr, struct Page *page, int flags) {
     assert(!(flags & PROT_LAZY) | !(flags & PROT_SHARE));
@@ -982,9 +1271,18 @@ map_page(struct AddressSpace *spc, uintptr_t addr, struct Page *page, int flags)
 
     if (!(flags & ALLOC_WEAK)) {
         page_ref(page);
-        unmap_page(spc, addr, page->class);
-        struct Page *mapping = page_lookup_virtual(spc->root, addr, page->class, LOOKUP_ALLOC);
-        if (!mapping) return -E_NO_MEM;
+        struct Page *mapping = vcache_mapping(spc, addr, page->class);
+        if (mapping) {
+            /* Replace a mapping of the same size in place,
+             * the shape of the tree does not change */
+            page_unref(mapping->phy);
+            list_del((struct List *)mapping);
+            unmap_page_pt(spc, addr, page->class);
+        } else {
+            unmap_page(spc, addr, page->class);
+            mapping = vtree_lookup(spc, addr, page->class, LOOKUP_ALLOC);
+            if (!mapping) return -E_NO_MEM;
+        }
 
         mapping->phy = page;
         mapping->state = (PAGE_PROT(flags) & ~PROT_COMBINE) | MAPPING_NODE;
@@ -1130,31 +1428,129 @@ unmap_region(struct AddressSpace *dspace, uintptr_t dst, uintptr_t size) {
     }
 }
 
+/*
+ * Pools of pre-zeroed pages, one per class up to MAX_ALLOCATION_CLASS.
+ * They are refilled up to 'high' pages by zero_pool_refill() when the CPU
+ * goes idle and the pool has dropped below 'low' pages, and are consumed
+ * by alloc_page() for ALLOC_ZERO requests.
+ * Every pooled page holds one reference so that
+ * page_unref() never merges it with its buddy
+ */
+#define ZERO_POOL_CLASSES (MAX_ALLOCATION_CLASS + 1)
+#define ZERO_POOL_MAX     256
+/* Bytes zeroed per zero_pool_refill() call. It runs with interrupts
+ * disabled, so large pages are zeroed over several idle periods */
+#define ZERO_POOL_BATCH (64 * KB)
+
+static struct ZeroPool {
+    struct Page *pages[ZERO_POOL_MAX];
+    size_t count;
+    size_t low, high;
+    bool refilling;       /* Dropped below low, topping up to high */
+    struct Page *partial; /* Page being zeroed, not pooled yet */
+    size_t zeroed;        /* Bytes of partial zeroed so far */
+    uint64_t hits, misses;
+} zero_pools[ZERO_POOL_CLASSES] = {
+        [0] = {.low = 64, .high = 256},
+        [MAX_ALLOCATION_CLASS] = {.low = 1, .high = 2},
+};
+
+static void
+zero_fill(struct Page *page) {
+    assert(current_space);
+    nosan_memset(KADDR(page2pa(page)), 0, CLASS_SIZE(page->class));
+}
+
+static struct Page *
+zero_pool_get(int class) {
+    if (class >= ZERO_POOL_CLASSES) return NULL;
+
+    struct ZeroPool *pool = &zero_pools[class];
+    if (!pool->count) {
+        pool->misses++;
+        return NULL;
+    }
+    pool->hits++;
+
+    /* Hand page over unreferenced like alloc_page()
+     * does, the caller is going to map it right away */
+    struct Page *page = pool->pages[--pool->count];
+    assert(page->refc == 1 && PAGE_IS_UNIQ(page));
+    page->refc = 0;
+    return page;
+}
+
+/* Returns all pooled pages to free lists, true if there were any */
+static bool
+zero_pool_drain(void) {
+    bool drained = 0;
+    for (size_t i = 0; i < ZERO_POOL_CLASSES; i++) {
+        struct ZeroPool *pool = &zero_pools[i];
+        while (pool->count) {
+            page_unref(pool->pages[--pool->count]);
+            drained = 1;
+        }
+        if (pool->partial) {
+            page_unref(pool->partial);
+            pool->partial = NULL;
+            drained = 1;
+        }
+    }
+    return drained;
+}
+
+/* Class to which shared lazy pages are split on write fault */
+static int cow_split_class = 0;
+
+/* Lazy page fault statistics */
+static struct {
+    uint64_t faults;       /* Resolved write faults */
+    uint64_t splits;       /* Faults which split shared page first */
+    uint64_t bytes_copied; /* Bytes copied from shared pages */
+    uint64_t cycles;       /* Total TSC cycles spent */
+    uint64_t max_cycles;   /* Slowest fault */
+} cow_stats;
+
+/* Huge page promotion statistics */
+static struct {
+    uint64_t promoted; /* 2MB ranges promoted */
+    uint64_t last;     /* TSC of the last idle pass */
+} thp_stats;
+
+/* Is physical page 'page' a part of physical page 'outer' */
+inline static bool
+page_within(struct Page *page, struct Page *outer) {
+    return page2pa(page) - page2pa(outer) < CLASS_SIZE(outer->class);
+}
+
 /* Just allocate page, without mapping it */
 static struct Page *
 alloc_page(int class, int flags) {
-    struct List *li = NULL;
     struct Page *peer = NULL;
 
+    /* Pooled zero pages are high memory */
+    if ((flags & (ALLOC_ZERO | ALLOC_POOL | ALLOC_BOOTMEM)) == ALLOC_ZERO &&
+        (peer = zero_pool_get(class))) return peer;
+
     if (flags & ALLOC_POOL) flags |= ALLOC_BOOTMEM;
 #ifndef SANITIZE_SHADOW_BASE
     if (current_space) flags &= ~ALLOC_BOOTMEM;
 #endif
 
-    /* Find page that is not smaller than requested
+    /* Find smallest page that is not smaller than requested
      * (Pool memory should also be within BOOT_MEM_SIZE) */
-    for (int pclass = class; pclass < MAX_CLASS; pclass++, li = NULL) {
-        for (li = free_classes[pclass].next; li != &free_classes[pclass]; li = li->next) {
-            peer = (struct Page *)li;
-            assert(peer->state == ALLOCATABLE_NODE);
-            assert_physical(peer);
-            if (!(flags & ALLOC_BOOTMEM) || page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) goto found;
-        }
+    peer = flags & ALLOC_HIGHMEM ? NULL : free_list_find(ZONE_BOOT, class, flags & ALLOC_BOOTMEM);
+    if (!(flags & ALLOC_BOOTMEM)) {
+        /* Boot memory is scarce and needed by descriptor pools,
+         * other allocations take high memory on ties */
+        struct Page *high = free_list_find(ZONE_HIGH, class, 0);
+        if (!peer || (high && (high->class < peer->class ||
+                               (high->class == peer->class && !(flags & ALLOC_POOL))))) peer = high;
     }
-    return NULL;
+    if (!peer) return !(flags & ALLOC_HIGHMEM) && (zero_pool_drain() | (pt_cache_drain() > 0)) ?
+                      alloc_page(class, flags) : NULL;
 
-found:
-    list_del(li);
+    list_del((struct List *)peer);
 
     size_t ndesc = 0;
     static bool allocating_pool;
@@ -1171,8 +1567,10 @@ found:
         for (size_t i = 0; i < ndesc; i++)
             list_append(&free_descriptors, (struct List *)&newpool->data[i]);
         newpool->next = first_pool;
+        newpool->live = 0;
         first_pool = newpool;
         free_desc_count += ndesc;
+        pool_stats.count++;
         if (trace_memory_more) cprintf("Allocated pool of size %zu at [%08lX, %08lX]\n",
                                        ndesc, page2pa(peer), page2pa(peer) + (long)CLASS_MASK(class));
     }
@@ -1193,24 +1591,58 @@ found:
                                        page2pa(new), page2pa(new) + (long)CLASS_MASK(new->class), new->class);
     }
 
+    if (flags & ALLOC_ZERO) zero_fill(new);
+
     assert(page2pa(new) >= PADDR(end) || page2pa(new) + CLASS_MASK(new->class) < IOPHYSMEM);
 
     return new;
 }
 
+/*
+ * Returns descriptor pools without live descriptors to free lists,
+ * keeping enough free descriptors for at least one more pool.
+ * Returns number of reclaimed pools
+ */
+size_t
+pool_reclaim(void) {
+    size_t ndesc = POOL_ENTRIES_FOR_SIZE(CLASS_SIZE(POOL_CLASS));
+    size_t reclaimed = 0;
+
+    for (struct PagePool **ppool = &first_pool; *ppool;) {
+        struct PagePool *pool = *ppool;
+        if (pool->live || free_desc_count < 2 * ndesc) {
+            ppool = &pool->next;
+            continue;
+        }
+
+        for (size_t i = 0; i < ndesc; i++)
+            list_del((struct List *)&pool->data[i]);
+        free_desc_count -= ndesc;
+        *ppool = pool->next;
+        pool_stats.count--;
+        pool_stats.reclaimed++;
+        reclaimed++;
+
+        /* This can only free descriptors of other pools */
+        page_unref(pool->peer);
+    }
+
+    return reclaimed;
+}
+
+static int
+maxref_walker(struct Page *node, uintptr_t base, void *arg) {
+    int *res = arg;
+    *res = MAX(*res, (int)(node->phy->refc + (node->phy->left || node->phy->right)));
+    return 0;
+}
+
 int
 region_maxref(struct AddressSpace *spc, uintptr_t addr, size_t size) {
     uintptr_t start = ROUNDDOWN(addr, PAGE_SIZE);
     uintptr_t end = ROUNDUP(addr + size, PAGE_SIZE);
     int res = 0;
-    while (start < end) {
-        struct Page *page = page_lookup_virtual(spc->root, start, 0, LOOKUP_PRESERVE);
-        if (page && page->phy) {
-            res = MAX(res, page->phy->refc + (page->phy->left || page->phy->right));
-            start += CLASS_SIZE(page->phy->class);
-        } else
-            start += CLASS_SIZE(0);
-    }
+    walk_virtual_range(spc->root, 0, MAX_CLASS, start, end, maxref_walker, &res);
     return res;
 }
 
@@ -1274,6 +1706,88 @@ map_physical_region(struct AddressSpace *dst, uintptr_t dstart, uintptr_t pstart
     return 0;
 }
 
+/*
+ * Tops up zero page pools which dropped below their low watermark.
+ * Called from sched_halt() so zeroing happens while CPU is idle.
+ * Zeroes at most ZERO_POOL_BATCH bytes per call, the rest is
+ * left for the following idle periods
+ */
+void
+zero_pool_refill(void) {
+    if (!current_space) return;
+
+    size_t budget = ZERO_POOL_BATCH;
+    for (size_t i = 0; i < ZERO_POOL_CLASSES; i++) {
+        struct ZeroPool *pool = &zero_pools[i];
+        if (pool->count < pool->low) pool->refilling = 1;
+
+        while (pool->refilling && pool->count < pool->high) {
+            if (!pool->partial) {
+                pool->partial = alloc_page(i, ALLOC_HIGHMEM);
+                if (!pool->partial) return;
+                page_ref(pool->partial);
+                pool->zeroed = 0;
+            }
+
+            size_t chunk = MIN(CLASS_SIZE(i) - pool->zeroed, budget);
+            nosan_memset((uint8_t *)KADDR(page2pa(pool->partial)) + pool->zeroed, 0, chunk);
+            pool->zeroed += chunk;
+            budget -= chunk;
+            if (pool->zeroed < CLASS_SIZE(i)) return;
+
+            pool->pages[pool->count++] = pool->partial;
+            pool->partial = NULL;
+            if (!budget) return;
+        }
+        pool->refilling = 0;
+    }
+}
+
+int
+zero_pool_set_watermarks(int class, size_t low, size_t high) {
+    if (class < 0 || class >= ZERO_POOL_CLASSES ||
+        low > high || high > ZERO_POOL_MAX) return -E_INVAL;
+
+    struct ZeroPool *pool = &zero_pools[class];
+    pool->low = low;
+    pool->high = high;
+    while (pool->count > high)
+        page_unref(pool->pages[--pool->count]);
+
+    return 0;
+}
+
+/* Prints zero page pool and lazy page fault statistics */
+void
+dump_memory_stats(void) {
+    for (size_t i = 0; i < ZERO_POOL_CLASSES; i++) {
+        struct ZeroPool *pool = &zero_pools[i];
+        if (!pool->high && !pool->hits && !pool->misses) continue;
+        cprintf(":zero_pool: class %02zu: %zu/%zu pages (low %zu), %lu hits, %lu misses\n",
+                i, pool->count, pool->high, pool->low,
+                (unsigned long)pool->hits, (unsigned long)pool->misses);
+    }
+
+    cprintf(":cow: split class %d, %lu faults, %lu splits, %lu KB copied, %lu cycles avg, %lu cycles max\n",
+            cow_split_class, (unsigned long)cow_stats.faults, (unsigned long)cow_stats.splits,
+            (unsigned long)(cow_stats.bytes_copied / KB),
+            (unsigned long)(cow_stats.faults ? cow_stats.cycles / cow_stats.faults : 0),
+            (unsigned long)cow_stats.max_cycles);
+
+    cprintf(":thp: %lu ranges promoted\n", (unsigned long)thp_stats.promoted);
+
+    size_t live = 0;
+    for (struct PagePool *pool = first_pool; pool; pool = pool->next)
+        live += pool->live;
+    cprintf(":pools: %zu pools (%zu KB), %zu live, %zu free descriptors, %zu reclaimed\n",
+            pool_stats.count, (size_t)(pool_stats.count * CLASS_SIZE(POOL_CLASS) / KB),
+            live, free_desc_count, pool_stats.reclaimed);
+    cprintf(":pt_cache: %zu/%d pages, %lu hits, %lu misses\n",
+            pt_cache.count, PT_CACHE_MAX, (unsigned long)pt_cache.hits, (unsigned long)pt_cache.misses);
+    cprintf(":vcache: %lu hits, %lu misses\n",
+            (unsigned long)vcache_stats.hits, (unsigned long)vcache_stats.misses);
+}
+
 /* Allocate page (possibly physically discontinuous) and map it to address space */
 int
 alloc_composite_page(struct AddressSpace *spc, uintptr_t addr, int class, int flags) {
@@ -1283,7 +1797,7 @@ alloc_composite_page(struct AddressSpace *spc, uintptr_t addr, int class, int fl
 
     struct Page *page = alloc_page(class, flags);
     if (page) {
-        res = map_page(spc, addr, page, flags);
+        res = map_page(spc, addr, page, flags & ~ALLOC_ZERO);
     } else if (class) {
         /* If bigger page is not found try
          * to compose page from smaller pages recursively */
@@ -1295,8 +1809,16 @@ alloc_composite_page(struct AddressSpace *spc, uintptr_t addr, int class, int fl
     return res;
 }
 
+int
+cow_set_split_class(int class) {
+    if (class < 0 || class > MAX_ALLOCATION_CLASS) return -E_INVAL;
+    cow_split_class = class;
+    return 0;
+}
+
 int
 force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
+    uint64_t start = read_tsc();
     int res = -E_FAULT;
     /* FIXME We need to propagate kernel PML4E
      * changes to every AddressSpace or just use KPTI
@@ -1313,10 +1835,24 @@ force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
 
 
     /* Lookup page mapping such that it's class it not larger than MAX_ALLOCATION_CLASS */
-    struct Page *page;
-    if (!(page = page_lookup_virtual(spc->root, va, maxclass, LOOKUP_SPLIT))) goto fault;
-    if (!(page = page_lookup_virtual(spc->root, va, 0, LOOKUP_PRESERVE))) goto fault;
-    if (!(page->state & PROT_LAZY)) goto fault;
+    struct Page *page = vcache_lookup(spc, va);
+    if (!page->phy || page->phy->class > maxclass) {
+        if (!vtree_lookup(spc, va, maxclass, LOOKUP_SPLIT)) goto fault;
+        page = vcache_lookup(spc, va);
+    }
+    if (!page->phy || !(page->state & PROT_LAZY)) goto fault;
+
+    /* A write into a shared lazy page (copy-on-write after fork or
+     * zero/one-filled memory) only makes private the cow_split_class
+     * sized part that was touched, untouched siblings stay shared.
+     * Callers that need the whole class to be private
+     * (do_map_page() passes MAX_CLASS) are not affected */
+    if (page->phy->class > cow_split_class && maxclass <= MAX_ALLOCATION_CLASS && !PAGE_IS_UNIQ(page->phy)) {
+        if (!vtree_lookup(spc, va, cow_split_class, LOOKUP_SPLIT)) goto fault;
+        page = vcache_lookup(spc, va);
+        assert(page->phy && page->phy->class == cow_split_class);
+        cow_stats.splits++;
+    }
 
     va &= ~CLASS_MASK(page->phy->class);
 
@@ -1333,11 +1869,30 @@ force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass) {
 
         struct Page *phy = page->phy;
         page_ref(phy);
-        res = alloc_composite_page(spc, va, phy->class, page->state & PROT_ALL & ~PROT_LAZY);
-        if (!res) memcpy_page(spc, va, phy);
+        if (page_within(phy, zero_page)) {
+            /* Copy of zero page can be taken from zero pool */
+            res = alloc_composite_page(spc, va, phy->class, (page->state & PROT_ALL & ~PROT_LAZY) | ALLOC_ZERO);
+        } else {
+            res = alloc_composite_page(spc, va, phy->class, page->state & PROT_ALL & ~PROT_LAZY);
+            if (!res) {
+                memcpy_page(spc, va, phy);
+                cow_stats.bytes_copied += CLASS_SIZE(phy->class);
+            }
+        }
+        if (!res && spc != &kspace) {
+            struct Env *env = (void *)((uint8_t *)spc - offsetof(struct Env, address_space));
+            env->env_acct.acct_fault_bytes += CLASS_SIZE(phy->class);
+        }
         page_unref(phy);
     }
 
+    if (!res) {
+        uint64_t cycles = read_tsc() - start;
+        cow_stats.faults++;
+        cow_stats.cycles += cycles;
+        cow_stats.max_cycles = MAX(cow_stats.max_cycles, cycles);
+    }
+
 fault:
     switch_address_space(old);
 
@@ -1353,6 +1908,105 @@ fault:
     return res;
 }
 
+/*
+ * Checks that virtual subtree is fully populated with uniquely
+ * owned, non-lazy, non-shared, cacheable mappings of normal memory
+ * which all have the same protection flags as *state
+ */
+static bool
+huge_promotable(struct Page *node, int *state) {
+    if (!node) return 0;
+
+    if (node->phy) {
+        if (node->state & (PROT_LAZY | PROT_SHARE | PROT_CD)) return 0;
+        if (node->phy->state != ALLOCATABLE_NODE || !PAGE_IS_UNIQ(node->phy)) return 0;
+        if (*state < 0) *state = node->state;
+        return node->state == *state;
+    }
+
+    return huge_promotable(node->left, state) && huge_promotable(node->right, state);
+}
+
+/* Copies memory mapped by virtual subtree to kernel address dst */
+static void
+huge_copy(struct Page *node, int class, uint8_t *dst) {
+    if (node->phy) {
+        nosan_memcpy(dst, KADDR(page2pa(node->phy)), CLASS_SIZE(class));
+    } else {
+        huge_copy(node->left, class - 1, dst);
+        huge_copy(node->right, class - 1, dst + CLASS_SIZE(class - 1));
+    }
+}
+
+/* Checks that the page directory covering va is in place, so
+ * that mapping a 2MB page there needs no page table allocations */
+static bool
+huge_pd_present(struct AddressSpace *spc, uintptr_t va) {
+    pml4e_t pml4e = spc->pml4[PML4_INDEX(va)];
+    if (!(pml4e & PTE_P)) return 0;
+
+    pdpe_t pdpe = ((pdpe_t *)KADDR(PTE_ADDR(pml4e)))[PDP_INDEX(va)];
+    return (pdpe & (PTE_P | PTE_PS)) == PTE_P;
+}
+
+static int
+huge_promote_walk(struct AddressSpace *spc, struct Page *node, int class, uintptr_t va) {
+    int state = -1, res = 0;
+
+    if (!node || node->phy || va >= MAX_USER_ADDRESS) return 0;
+
+    if (class > HUGE_PAGE_CLASS) {
+        res = huge_promote_walk(spc, node->left, class - 1, va);
+        if (res < 0) return res;
+        int res2 = huge_promote_walk(spc, node->right, class - 1, va + CLASS_SIZE(class - 1));
+        return res2 < 0 ? res2 : res + res2;
+    }
+
+    if (!huge_promotable(node, &state)) return 0;
+
+    /* map_page() frees the small pages before it allocates page
+     * tables, so a failure there would lose the copied data */
+    if (!huge_pd_present(spc, va)) return 0;
+
+    struct Page *page = alloc_page(HUGE_PAGE_CLASS, 0);
+    if (!page) return -E_NO_MEM;
+
+    huge_copy(node, class, KADDR(page2pa(page)));
+    /* Old small pages are unmapped and freed here. Their descriptors
+     * cover the new tree node and the page directory is present,
+     * so this cannot fail */
+    res = map_page(spc, va, page, PAGE_PROT(state));
+    assert(!res);
+
+    thp_stats.promoted++;
+    return 1;
+}
+
+/*
+ * Replaces every 2MB-aligned user range of 'spc' that is fully mapped
+ * by private small pages with equal protections by single 2MB page.
+ * Returns the number of promoted ranges.
+ */
+int
+huge_promote(struct AddressSpace *spc) {
+    assert(spc != &kspace);
+    return huge_promote_walk(spc, spc->root, MAX_CLASS, 0);
+}
+
+/* Promotion pass over all environments,
+ * run from sched_halt() at most 10 times per second */
+void
+huge_promote_idle(void) {
+    uint64_t now = read_tsc();
+    if (now - thp_stats.last < vsys->vsys_tsc_freq / 10) return;
+    thp_stats.last = now;
+
+    for (size_t i = 0; i < NENV; i++) {
+        if (envs[i].env_status == ENV_FREE || envs[i].env_status == ENV_DYING) continue;
+        if (huge_promote(&envs[i].address_space) < 0) break;
+    }
+}
+
 static int
 do_map_page(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, struct Page *phy, int oldflags, int flags) {
     int res;
@@ -1443,8 +2097,6 @@ do_map_subtree(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *
     return res;
 }
 
-static struct Page *zero_page, *one_page;
-
 static int
 do_map_region_one_page(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, int class, int flags) {
     if (dspace == sspace && src != dst) assert(ABSDIFF(dst, src) >= CLASS_SIZE(class));
@@ -1454,13 +2106,13 @@ do_map_region_one_page(struct AddressSpace *dspace, uintptr_t dst, struct Addres
         if (flags & PROT_SHARE) {
             /* Shared pages cannot be lazily allocated
              * So just allocate them and filled with 0's/FF's */
-            res = alloc_composite_page(dspace, dst, class, flags & PROT_ALL & ~(PROT_LAZY | PROT_COMBINE));
-            if (!res) {
+            res = alloc_composite_page(dspace, dst, class, (flags & (PROT_ALL | ALLOC_ZERO)) & ~(PROT_LAZY | PROT_COMBINE));
+            if (!res && flags & ALLOC_ONE) {
                 assert(current_space);
                 assert(dspace);
                 struct AddressSpace *old = switch_address_space(dspace);
                 set_wp(0);
-                nosan_memset((void *)dst, flags & ALLOC_ONE ? 0xFF : 0x00, CLASS_SIZE(class));
+                nosan_memset((void *)dst, 0xFF, CLASS_SIZE(class));
                 set_wp(1);
                 switch_address_space(old);
             }
@@ -1484,7 +2136,7 @@ do_map_region_one_page(struct AddressSpace *dspace, uintptr_t dst, struct Addres
             }
         }
     } else {
-        struct Page *page1 = page_lookup_virtual(sspace->root, src, class, LOOKUP_ALLOC);
+        struct Page *page1 = vtree_lookup(sspace, src, class, LOOKUP_ALLOC);
         assert(page1);
         if (page1->phy && page1->phy->class > class) {
             /* We need to split physical page if part of it is remapped */
@@ -1552,10 +2204,14 @@ release_address_space(struct AddressSpace *space) {
     unmap_page(space, 0, MAX_CLASS);
 
     /* Also unmap PML4 itself since it is never deallocated by page_uname*/
-    page_unref(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+    pt_page_free(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+
+    pcid_map[space->pcid / 64] &= ~(1ULL << (space->pcid % 64));
 
     /* Zero-out metadata */
     memset(space, 0, sizeof *space);
+
+    pool_reclaim();
 }
 
 
@@ -1579,7 +2235,15 @@ switch_address_space(struct AddressSpace *space) {
         return space;
     }
 
-    lcr3(space->cr3);
+    uint64_t cr3 = space->cr3;
+    if (pcid_supported) {
+        /* Without CR3_NOFLUSH only entries of the new PCID are dropped */
+        cr3 |= space->pcid;
+        if (!space->pcid_stale) cr3 |= CR3_NOFLUSH;
+        space->pcid_stale = 0;
+    }
+
+    lcr3(cr3);
     struct AddressSpace *old = current_space;
     current_space = space;
 
@@ -1611,6 +2275,16 @@ init_address_space(struct AddressSpace *space) {
 
     /* Why this call is required here and what does it do? */
     propagate_one_pml4(space, &kspace);
+
+    /* Previous owner of the PCID could leave entries in TLB */
+    size_t i = 0;
+    while (i < NPCID / 64 && !~pcid_map[i]) i++;
+    assert(i < NPCID / 64);
+    int bit = __builtin_ctzll(~pcid_map[i]);
+    pcid_map[i] |= 1ULL << bit;
+    space->pcid = i * 64 + bit;
+    space->pcid_stale = 1;
+
     return 0;
 }
 
@@ -1711,13 +2385,16 @@ detect_memory(void) {
 
 static void
 init_allocator(void) {
-    static struct Page initial_buffer[INIT_DESCR];
-
     metaheaptop = KERN_HEAP_START + ROUNDUP(uefi_lp->FrameBufferSize, PAGE_SIZE);
 
+    static_assert(MAX_CLASS <= 64, "free_class_map is too narrow");
+
     /* Initialize lists */
-    for (size_t i = 0; i < MAX_CLASS; i++)
-        list_init(&free_classes[i]);
+    for (size_t z = 0; z < NZONES; z++) {
+        for (size_t i = 0; i < MAX_CLASS; i++)
+            list_init(&free_classes[z][i]);
+        free_class_map[z] = 0;
+    }
 
     /* Initialize first pool */
 
@@ -1734,6 +2411,32 @@ init_allocator(void) {
     root.state = PARTIAL_NODE;
 }
 
+/*
+ * Allocates physically contiguous page of given class
+ * and returns its address in the kernel direct mapping
+ */
+void *
+kpage_alloc(int class) {
+    assert(current_space);
+
+    struct Page *page = alloc_page(class, 0);
+    if (!page) return NULL;
+    page_ref(page);
+
+    void *va = KADDR(page2pa(page));
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(va, CLASS_SIZE(class));
+#endif
+    return va;
+}
+
+void
+kpage_free(void *va, int class) {
+    struct Page *page = page_lookup(NULL, PADDR(va), class, PARTIAL_NODE, 0);
+    assert(page && page->class == class && page->refc == 1);
+    page_unref(page);
+}
+
 void *
 kzalloc_region(size_t size) {
     assert(current_space);
@@ -1852,6 +2555,10 @@ void
 init_memory(void) {
     int res = -1;
 
+    nx_supported = cpu_has(CPU_FEATURE_NX);
+    has_1gb_pages = cpu_has(CPU_FEATURE_PDPE1GB);
+    pcid_supported = cpu_has(CPU_FEATURE_PCID) && cpu_has(CPU_FEATURE_INVPCID);
+
     init_allocator();
     if (trace_init) cprintf("Memory allocator is initialized\n");
 
@@ -1928,12 +2635,14 @@ init_memory(void) {
     /* Set appropriate cr0 and cr4 bits
      * (In assembly code only minimal set of modes was set)*/
     lcr0(CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_MP);
-    lcr4(CR4_PSE | CR4_PAE | CR4_PCE);
+    lcr4(CR4_PSE | CR4_PAE | CR4_PCE | (pcid_supported ? CR4_PCIDE : 0));
 
     /* Enable NX bit (execution protection) */
-    uint64_t efer = rdmsr(EFER_MSR);
-    efer |= EFER_NXE;
-    wrmsr(EFER_MSR, efer);
+    if (nx_supported) {
+        uint64_t efer = rdmsr(EFER_MSR);
+        efer |= EFER_NXE;
+        wrmsr(EFER_MSR, efer);
+    }
 
     for (size_t i = 0; i < CLASS_SIZE(MAX_ALLOCATION_CLASS); i++)
         assert(!zero_page_raw[i]);
@@ -2032,10 +2741,9 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm) {
     // LAB 8: Your code here
 
     void *cur = (void *)ROUNDDOWN(va, PAGE_SIZE);
-    struct Page *root_page = env->address_space.root;
-    
+
     while (cur < va + len) {
-        struct Page *cur_page = page_lookup_virtual(root_page, (uintptr_t)cur, 0, 0);
+        struct Page *cur_page = vcache_lookup(&env->address_space, (uintptr_t)cur);
 
         if (!cur_page->phy || (cur_page->state & PAGE_PROT(perm)) != PAGE_PROT(perm)) {
             user_mem_check_addr = (uintptr_t)MAX(va, cur);
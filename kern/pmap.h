@@ -67,6 +67,8 @@ void __nosan_memmove(void *, void *, size_t);
 
 /* Maximal size of page allocated on pagefault */
 #define MAX_ALLOCATION_CLASS 9
+/* Class of 2MB hardware pages */
+#define HUGE_PAGE_CLASS 9
 
 enum PageState {
     MAPPING_NODE = 0x100000,      /* Memory mapping (part of virtual tree) */
@@ -101,6 +103,7 @@ struct Page {
 struct PagePool {
     struct Page *peer;     /* Page from which memory is taken */
     struct PagePool *next; /* Next pool link */
+    size_t live;           /* Descriptors currently in use */
     struct Page data[];    /* Page descriptors storage */
 };
 
@@ -117,9 +120,23 @@ int region_maxref(struct AddressSpace *spc, uintptr_t addr, size_t size);
 int force_alloc_page(struct AddressSpace *spc, uintptr_t va, int maxclass);
 void dump_page_table(pte_t *pml4);
 void dump_memory_lists(void);
+void alloc_bench(size_t count);
+void dump_memory_stats(void);
+int cow_set_split_class(int class);
+int huge_promote(struct AddressSpace *spc);
+void huge_promote_idle(void);
+size_t pool_reclaim(void);
+size_t pt_cache_drain(void);
+
+extern void (*tlb_invalidate_range)(struct AddressSpace *spc, uintptr_t start, uintptr_t end);
+void tlb_invalidate_range_pcid(struct AddressSpace *spc, uintptr_t start, uintptr_t end);
+void zero_pool_refill(void);
+int zero_pool_set_watermarks(int class, size_t low, size_t high);
 void dump_virtual_tree(struct Page *node, int class);
 
 void *kzalloc_region(size_t size);
+void *kpage_alloc(int class);
+void kpage_free(void *va, int class);
 
 void *mmio_map_region(physaddr_t addr, size_t size);
 void *mmio_remap_last_region(physaddr_t addr, void *oldva, size_t oldsz, size_t size);
@@ -2,14 +2,46 @@
 #include <inc/x86.h>
 #include <inc/string.h>
 #include <kern/env.h>
+#include <kern/ktimer.h>
 #include <kern/monitor.h>
 #include <kern/pmap.h>
+#include <kern/timer.h>
 #include <kern/traceopt.h>
+#include <kern/vsyscall.h>
 
 
 struct Taskstate cpu_ts;
 _Noreturn void sched_halt(void);
 
+/* Run queue of ENV_RUNNABLE environments, linked through env_runq_link.
+ * Envs are appended when they become runnable and popped from the head by
+ * sched_yield(), so choosing the next env does not depend on NENV.
+ * An env is not on the queue iff its env_runq_link.next is NULL. */
+static struct List runq = {&runq, &runq};
+
+/* Appends env to the tail of the run queue if it's not queued yet */
+void
+sched_enqueue(struct Env *env) {
+    if (env->env_runq_link.next) return;
+
+    struct List *link = &env->env_runq_link;
+    link->next = &runq;
+    link->prev = runq.prev;
+    runq.prev->next = link;
+    runq.prev = link;
+}
+
+/* Removes env from the run queue, does nothing if it's not queued */
+void
+sched_dequeue(struct Env *env) {
+    struct List *link = &env->env_runq_link;
+    if (!link->next) return;
+
+    link->next->prev = link->prev;
+    link->prev->next = link->next;
+    link->next = link->prev = NULL;
+}
+
 /* This function checks if specified env is stopped via sigwait and if so, looks up
  * for specified signals and if any exists, allows to continue execution. If not, continue waiting. 
  * Returned values: 
@@ -85,43 +117,50 @@ _Noreturn void
 sched_yield(void) {
     /* Implement simple round-robin scheduling.
      *
-     * Search through 'envs' for an ENV_RUNNABLE environment in
-     * circular fashion starting just after the env was
-     * last running.  Switch to the first such environment found.
+     * Runnable environments are kept in the run queue in the order
+     * they became runnable. Put the environment that was running
+     * to the tail (it is okay to choose it again if nothing else is
+     * runnable) and switch to the first one at the head.
      *
-     * If no envs are runnable, but the environment previously
-     * running is still ENV_RUNNING, it's okay to
-     * choose that environment.
+     * Environments stopped via SIGSTOP or waiting in sigwait are
+     * dropped from the queue here and put back by sys_sigqueue()
+     * once SIGCONT or one of the awaited signals arrives.
      *
      * If there are no runnable environments,
      * simply drop through to the code
      * below to halt the cpu */
 
     // LAB 3: Your code here:
-    int next_idx = curenv ? curenv - envs : 0;
+    if (curenv && curenv->env_status == ENV_RUNNING) {
+        curenv->env_status = ENV_RUNNABLE;
+        sched_enqueue(curenv);
+    }
+
+    /* Wake up sleepers whose time has come */
+    ktimer_expire();
 
-    for (int i = 0; i < NENV + 1; i++) {
-        next_idx = (next_idx + 1) % NENV;
+    while (runq.next != &runq) {
+        struct Env *env = (struct Env *)((uint8_t *)runq.next - offsetof(struct Env, env_runq_link));
+        sched_dequeue(env);
 
-        if (envs[next_idx].env_status != ENV_RUNNABLE && envs[next_idx].env_status != ENV_RUNNING) {
+        if (env->env_status != ENV_RUNNABLE) {
             continue;
         }
 
         /* you can't look up for sigcont here */
-        if (envs[next_idx].env_sig_stopped) {
+        if (env->env_sig_stopped) {
             continue;
         }
 
-        /* If we are stopped via sigwait, we need to look for specified signals. Probably need to add special function? */
-        if (check4pending_sigwait(&envs[next_idx])) {
+        /* If we are stopped via sigwait, we need to look for specified signals */
+        if (check4pending_sigwait(env)) {
             continue;
         }
 
-        env_run(&envs[next_idx]);
+        timer_tick_restart();
+        env_run(env);
     }
 
-    cprintf("Halt\n");
-
     /* No runnable environments,
      * so just halt the cpu */
     sched_halt();
@@ -138,14 +177,26 @@ sched_halt(void) {
     for (i = 0; i < NENV; i++)
         if (envs[i].env_status == ENV_RUNNABLE ||
             envs[i].env_status == ENV_RUNNING) break;
-    if (i == NENV) {
+    if (i == NENV && !ktimer_pending()) {
+        cprintf("Halt\n");
         cprintf("No runnable environments in the system!\n");
         for (;;) monitor(NULL);
     }
 
     /* Mark that no environment is running on CPU */
+    env_charge_runtime();
+    vsys->vsys_curenv = 0;
     curenv = NULL;
 
+    /* Use idle time to prepare zeroed pages
+     * and to promote user memory to huge pages */
+    zero_pool_refill();
+    huge_promote_idle();
+
+    /* Nothing can become runnable until an interrupt comes
+     * or the first sleeping env's deadline */
+    timer_tick_stop(ktimer_next());
+
     /* Reset stack pointer, enable interrupts and then halt */
     asm volatile(
             "movq $0, %%rbp\n"
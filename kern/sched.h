@@ -6,6 +6,10 @@
 #error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+struct Env;
+
 _Noreturn void sched_yield(void);
+void sched_enqueue(struct Env *env);
+void sched_dequeue(struct Env *env);
 
 #endif /* !JOS_KERN_SCHED_H */
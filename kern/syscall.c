@@ -4,10 +4,12 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/sysring.h>
 
 #include <kern/console.h>
 #include <kern/env.h>
 #include <kern/kclock.h>
+#include <kern/ktimer.h>
 #include <kern/pmap.h>
 #include <kern/sched.h>
 #include <kern/syscall.h>
@@ -109,6 +111,7 @@ sys_exofork(void) {
         return res;
     }
 
+    sched_dequeue(new);
     new->env_status = ENV_NOT_RUNNABLE;
     new->env_tf = curenv->env_tf;
     new->env_tf.tf_regs.reg_rax = 0;
@@ -143,6 +146,13 @@ sys_env_set_status(envid_t envid, int status) {
     }
 
     new->env_status = status;
+
+    if (status == ENV_RUNNABLE) {
+        sched_enqueue(new);
+    } else {
+        sched_dequeue(new);
+    }
+
     return 0;
 }
 
@@ -334,6 +344,53 @@ sys_map_physical_region(uintptr_t pa, envid_t envid, uintptr_t va, size_t size,
     return map_physical_region(&new->address_space, va, pa, size, perm | PROT_USER_ | MAP_USER_MMIO);
 }
 
+/* Deliver 'value' and the region mapped at 'srcva' in src's address space
+ * to dst, which must be ready to receive, filling dst's env_ipc_* fields
+ * the way sys_ipc_try_send() describes.  Doesn't change dst's status.
+ *
+ * Returns 0 on success, -E_INVAL or -E_NO_MEM on error. */
+static int
+ipc_deliver(struct Env *dst, struct Env *src, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    if (srcva < MAX_USER_ADDRESS && dst->env_ipc_dstva < MAX_USER_ADDRESS) {
+        // page alignment
+        if (srcva & CLASS_MASK(0) || dst->env_ipc_dstva & CLASS_MASK(0)) {
+            return -E_INVAL;
+        }
+
+        // perm check
+        if (perm & ~PROT_ALL) {
+            return -E_INVAL;
+        }
+
+        // mapping and write permission check
+        // if ((perm & PROT_W) && user_mem_check(src, (void *)srcva, size, PROT_W) < 0) {
+        //     return -E_INVAL;
+        // }
+
+        // trying to map region with min length to dstva
+        size_t min = MIN(size, dst->env_ipc_maxsz);
+        
+        if (map_region(&dst->address_space, dst->env_ipc_dstva, &src->address_space, srcva, 
+                min, perm | PROT_USER_) < 0) {
+            return -E_NO_MEM;
+        }
+        
+        dst->env_ipc_perm = perm;
+        dst->env_ipc_maxsz = min;
+    } else {
+        dst->env_ipc_perm = 0;
+    }
+
+    dst->env_ipc_recving = 0;
+    ktimer_cancel(dst);
+    dst->env_ipc_from = src->env_id;
+    dst->env_ipc_value = value;
+    dst->env_acct.acct_ipc_recvs++;
+    src->env_acct.acct_ipc_sends++;
+
+    return 0;
+}
+
 /* Try to send 'value' to the target env 'envid'.
  * If srcva < MAX_USER_ADDRESS, then also send region currently mapped at 'srcva',
  * so that receiver gets mapping.
@@ -391,40 +448,148 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
         return -E_INVAL;
     }
 
-    if (srcva < MAX_USER_ADDRESS && dst->env_ipc_dstva < MAX_USER_ADDRESS) {
-        // page alignment
-        if (srcva & CLASS_MASK(0) || dst->env_ipc_dstva & CLASS_MASK(0)) {
-            return -E_INVAL;
-        }
+    int res = ipc_deliver(dst, curenv, value, srcva, size, perm);
+    if (res < 0) return res;
 
-        // perm check
-        if (perm & ~PROT_ALL) {
-            return -E_INVAL;
+    dst->env_status = ENV_RUNNABLE;
+    sched_enqueue(dst);
+
+    return 0;
+}
+
+/* Send 'value' (and the region at 'srcva', like sys_ipc_try_send() does)
+ * to the target env 'envid', blocking until it is received.
+ *
+ * If the target is not blocked in sys_ipc_recv, the sender is marked
+ * not runnable and put at the tail of the target's env_ipc_senders queue
+ * with the message saved in its env_ipc_send_* fields.  The target's next
+ * sys_ipc_recv takes the first queued message without blocking and makes
+ * the sender runnable again, so senders don't have to spin on
+ * sys_ipc_try_send.
+ *
+ * This function only returns when the message is delivered immediately
+ * or on error, but the system call eventually returns 0 on success or
+ * the delivery error.
+ * Returns < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist
+ *      or is destroyed before receiving the message.
+ *  -E_INVAL if envid is the current environment.
+ *  -E_INVAL if srcva < MAX_USER_ADDRESS but srcva is not page-aligned
+ *      or perm is inappropriate.
+ *  -E_NO_MEM if there's not enough memory to map srcva in envid's
+ *      address space. */
+static int
+sys_ipc_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    struct Env *dst = NULL;
+
+    if (envid2env(envid, &dst, 0) < 0) {
+        return -E_BAD_ENV;
+    }
+
+    if (dst == curenv) {
+        return -E_INVAL;
+    }
+
+    if (srcva < MAX_USER_ADDRESS && (srcva & CLASS_MASK(0) || perm & ~PROT_ALL)) {
+        return -E_INVAL;
+    }
+
+    if (dst->env_ipc_recving) {
+        return sys_ipc_try_send(envid, value, srcva, size, perm);
+    }
+
+    curenv->env_ipc_send_value = value;
+    curenv->env_ipc_send_srcva = srcva;
+    curenv->env_ipc_send_size = size;
+    curenv->env_ipc_send_perm = perm;
+
+    struct List *link = &curenv->env_ipc_link;
+    link->next = &dst->env_ipc_senders;
+    link->prev = dst->env_ipc_senders.prev;
+    dst->env_ipc_senders.prev->next = link;
+    dst->env_ipc_senders.prev = link;
+
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    curenv->env_tf.tf_regs.reg_rax = 0;
+    sched_yield();
+
+    return 0;
+}
+
+/* Removes env from the env_ipc_senders queue it is blocked on */
+static void
+ipc_unlink_sender(struct Env *env) {
+    struct List *link = &env->env_ipc_link;
+    link->next->prev = link->prev;
+    link->prev->next = link->next;
+    link->next = link->prev = NULL;
+}
+
+/* Wakes up a sender blocked in sys_ipc_send with result 'res'.
+ * A sender blocked in sys_ipc_call whose message was delivered
+ * stays blocked, now waiting for the reply. */
+static void
+ipc_wakeup_sender(struct Env *env, int res) {
+    ipc_unlink_sender(env);
+
+    if (env->env_ipc_calling) {
+        env->env_ipc_calling = 0;
+        if (!res) {
+            env->env_ipc_recving = 1;
+            return;
         }
+    }
 
-        // mapping and write permission check
-        // if ((perm & PROT_W) && user_mem_check(curenv, (void *)srcva, size, PROT_W) < 0) {
-        //     return -E_INVAL;
-        // }
+    env->env_tf.tf_regs.reg_rax = res;
+    env->env_status = ENV_RUNNABLE;
+    sched_enqueue(env);
+}
 
-        // trying to map region with min length to dstva
-        size_t min = MIN(size, dst->env_ipc_maxsz);
-        
-        if (map_region(&dst->address_space, dst->env_ipc_dstva, &curenv->address_space, srcva, 
-                min, perm | PROT_USER_) < 0) {
-            return -E_NO_MEM;
+/* Called when env is freed: fail the senders blocked on env
+ * and drop env from the queue of the env it was sending to. */
+void
+ipc_cancel(struct Env *env) {
+    if (env->env_ipc_link.next) {
+        ipc_unlink_sender(env);
+    }
+
+    while (env->env_ipc_senders.next && env->env_ipc_senders.next != &env->env_ipc_senders) {
+        struct Env *src = (struct Env *)((uint8_t *)env->env_ipc_senders.next - offsetof(struct Env, env_ipc_link));
+        ipc_wakeup_sender(src, -E_BAD_ENV);
+    }
+}
+
+/* Check sys_ipc_recv arguments and record where env wants to
+ * receive a region.  Returns 0 on success, -E_INVAL on error. */
+static int
+ipc_prepare_recv(struct Env *env, uintptr_t dstva, size_t maxsize) {
+    if (maxsize & CLASS_MASK(0)) {
+        return -E_INVAL;
+    }
+
+    if (dstva < MAX_USER_ADDRESS) {
+        if (!maxsize || dstva & CLASS_MASK(0)) {
+            return -E_INVAL;
         }
-        
-        dst->env_ipc_perm = perm;
-        dst->env_ipc_maxsz = min;
-    } else {
-        dst->env_ipc_perm = 0;
+
+        env->env_ipc_dstva = dstva;
+        env->env_ipc_maxsz = maxsize;
     }
 
-    dst->env_ipc_recving = 0;
-    dst->env_ipc_from = curenv->env_id;
-    dst->env_ipc_value = value;
-    dst->env_status = ENV_RUNNABLE;
+    return 0;
+}
+
+/* Take the first message from a sender blocked on env, if any.
+ * Returns 1 if a message was received, 0 otherwise. */
+static bool
+ipc_recv_queued(struct Env *env) {
+    while (env->env_ipc_senders.next != &env->env_ipc_senders) {
+        struct Env *src = (struct Env *)((uint8_t *)env->env_ipc_senders.next - offsetof(struct Env, env_ipc_link));
+        int res = ipc_deliver(env, src, src->env_ipc_send_value, src->env_ipc_send_srcva,
+                              src->env_ipc_send_size, src->env_ipc_send_perm);
+        ipc_wakeup_sender(src, res);
+        if (!res) return 1;
+    }
 
     return 0;
 }
@@ -436,36 +601,145 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
  * If 'dstva' is < MAX_USER_ADDRESS, then you are willing to receive a page of data.
  * 'dstva' is the virtual address at which the sent page should be mapped.
  *
+ * If 'timeout' is not 0, give up after 'timeout' nanoseconds.
+ *
  * This function only returns on error, but the system call will eventually
  * return 0 on success.
  * Return < 0 on error.  Errors are:
  *  -E_INVAL if dstva < MAX_USER_ADDRESS but dstva is not page-aligned;
  *  -E_INVAL if dstva is valid and maxsize is 0,
- *  -E_INVAL if maxsize is not page aligned. */
+ *  -E_INVAL if maxsize is not page aligned,
+ *  -E_TIMEOUT if nothing was received within 'timeout'. */
 static int
-sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize) {
+sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize, uint64_t timeout) {
     // LAB 9: Your code here
-    if (maxsize & CLASS_MASK(0)) {
-        return -E_INVAL;
-    }
-
-    if (dstva < MAX_USER_ADDRESS) {
-        if (!maxsize || dstva & CLASS_MASK(0)) {
-            return -E_INVAL;
-        }
+    int res = ipc_prepare_recv(curenv, dstva, maxsize);
+    if (res < 0) return res;
 
-        curenv->env_ipc_dstva = dstva;
-        curenv->env_ipc_maxsz = maxsize;
+    if (ipc_recv_queued(curenv)) {
+        return 0;
     }
 
     curenv->env_status = ENV_NOT_RUNNABLE;
     curenv->env_ipc_recving = 1;
     curenv->env_tf.tf_regs.reg_rax = 0;
+    if (timeout) ktimer_sleep(curenv, ktimer_now() + timeout);
     sched_yield();
 
     return 0;
 }
 
+/* Switch straight to 'env', which has just been made ready to run
+ * by an IPC, bypassing the run queue. */
+static _Noreturn void
+ipc_handoff(struct Env *env) {
+    env->env_status = ENV_RUNNABLE;
+
+    if (env->env_sig_stopped) {
+        sched_enqueue(env);
+        sched_yield();
+    }
+
+    env_run(env);
+}
+
+/* Send a request to 'envid' and block until it replies: a combined
+ * sys_ipc_send and sys_ipc_recv for client/server round trips.
+ *
+ * 'value', 'srcva', 'size' and 'perm' describe the request like in
+ * sys_ipc_send.  The reply is received like with sys_ipc_recv(dstva, PAGE_SIZE).
+ *
+ * If the server is blocked in sys_ipc_recv, the request is delivered and
+ * the CPU is switched directly to the server without going through
+ * sched_yield.  Otherwise the caller is queued on the server like a
+ * blocked sender and starts waiting for the reply once the server
+ * takes the request.
+ *
+ * This function only returns on error, but the system call will eventually
+ * return 0 on success.
+ * Returns < 0 on error.  Errors are the ones of sys_ipc_send and sys_ipc_recv. */
+static int
+sys_ipc_call(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm, uintptr_t dstva) {
+    struct Env *dst = NULL;
+
+    if (envid2env(envid, &dst, 0) < 0) {
+        return -E_BAD_ENV;
+    }
+
+    if (dst == curenv) {
+        return -E_INVAL;
+    }
+
+    if (srcva < MAX_USER_ADDRESS && (srcva & CLASS_MASK(0) || perm & ~PROT_ALL)) {
+        return -E_INVAL;
+    }
+
+    int res = ipc_prepare_recv(curenv, dstva, PAGE_SIZE);
+    if (res < 0) return res;
+
+    if (dst->env_ipc_recving) {
+        res = ipc_deliver(dst, curenv, value, srcva, size, perm);
+        if (res < 0) return res;
+
+        curenv->env_status = ENV_NOT_RUNNABLE;
+        curenv->env_ipc_recving = 1;
+        curenv->env_tf.tf_regs.reg_rax = 0;
+        ipc_handoff(dst);
+    }
+
+    curenv->env_ipc_calling = 1;
+    return sys_ipc_send(envid, value, srcva, size, perm);
+}
+
+/* Reply to 'envid' and receive the next request: a combined
+ * sys_ipc_try_send and sys_ipc_recv for servers.
+ *
+ * The reply is sent like with sys_ipc_try_send, so 'envid' must be
+ * blocked receiving (which is always the case for sys_ipc_call clients).
+ * The next request is received like with sys_ipc_recv(dstva, PAGE_SIZE).
+ * If no request is queued, the CPU is switched directly to the client.
+ *
+ * This function only returns on error or if a request was already queued,
+ * but the system call will eventually return 0 on success.
+ * Returns < 0 on error, nothing is received in that case.
+ * Errors are the ones of sys_ipc_try_send and sys_ipc_recv. */
+static int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm, uintptr_t dstva) {
+    struct Env *dst = NULL;
+
+    if (dstva < MAX_USER_ADDRESS && dstva & CLASS_MASK(0)) {
+        return -E_INVAL;
+    }
+
+    if (envid2env(envid, &dst, 0) < 0) {
+        return -E_BAD_ENV;
+    }
+
+    if (!dst->env_ipc_recving) {
+        return -E_IPC_NOT_RECV;
+    }
+
+    if (srcva < MAX_USER_ADDRESS && srcva & CLASS_MASK(0)) {
+        return -E_INVAL;
+    }
+
+    int res = ipc_deliver(dst, curenv, value, srcva, size, perm);
+    if (res < 0) return res;
+
+    ipc_prepare_recv(curenv, dstva, PAGE_SIZE);
+
+    if (ipc_recv_queued(curenv)) {
+        dst->env_status = ENV_RUNNABLE;
+        sched_enqueue(dst);
+        return 0;
+    }
+
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    curenv->env_ipc_recving = 1;
+    curenv->env_tf.tf_regs.reg_rax = 0;
+    ipc_handoff(dst);
+}
+
 /*
  * This function sets trapframe and is unsafe
  * so you need:
@@ -561,6 +835,7 @@ sys_sigqueue(pid_t pid, int sig, const union sigval value) {
 
     if (sig == SIGSTOP) {
         new->env_sig_stopped = 1;
+        sched_dequeue(new);
         struct Env *penv = NULL;
 
         if (envid2env(new->env_parent_id, &penv, false)) {
@@ -580,6 +855,10 @@ sys_sigqueue(pid_t pid, int sig, const union sigval value) {
 
     if (sig == SIGCONT && new->env_sig_stopped) {
         new->env_sig_stopped = 0;
+
+        if (new->env_status == ENV_RUNNABLE) {
+            sched_enqueue(new);
+        }
         struct Env *penv = NULL;
 
         if (envid2env(new->env_parent_id, &penv, false)) {
@@ -644,6 +923,11 @@ sys_sigqueue(pid_t pid, int sig, const union sigval value) {
         sa->sa_flags &= ~SA_SIGINFO;
     }
 
+    /* Wake up the env if it is blocked in sigwait for this signal */
+    if ((new->env_sig_awaiting & SIGNAL_MASK(sig)) && new->env_status == ENV_RUNNABLE) {
+        sched_enqueue(new);
+    }
+
     if (trace_signals) {
         cprintf("signals: sent signal %d from %x to %x\n", sig, curenv->env_id, pid);
     }
@@ -798,6 +1082,85 @@ sys_sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
     return 0;
 }
 
+/* Block the current environment for 'ns' nanoseconds.
+ * Sleeping for 0 nanoseconds just yields the CPU.
+ * Returns 0. */
+static int
+sys_sleep(uint64_t ns) {
+    if (!ns) {
+        curenv->env_tf.tf_regs.reg_rax = 0;
+        sys_yield();
+    }
+
+    ktimer_sleep(curenv, ktimer_now() + ns);
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    return 0;
+}
+
+/* Whether system call 'num' may be issued from a syscall ring.
+ * Calls that block, switch environments or rewrite the caller's
+ * trapframe would leave the rest of the batch stranded. */
+static bool
+batchable(uint64_t num) {
+    switch (num) {
+    case SYS_cputs:
+    case SYS_getenvid:
+    case SYS_alloc_region:
+    case SYS_map_region:
+    case SYS_map_physical_region:
+    case SYS_unmap_region:
+    case SYS_region_refs:
+    case SYS_env_set_status:
+    case SYS_env_set_pgfault_upcall:
+    case SYS_ipc_try_send:
+    case SYS_gettime:
+    case SYS_sigaction:
+    case SYS_sigprocmask:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Execute the system calls queued in the submission ring at 'ring'
+ * and post their results to the completion ring.
+ * Stops when the submission ring is empty or the completion ring is full.
+ * Submissions that may not be batched complete with -E_INVAL.
+ *
+ * Returns the number of submissions consumed, < 0 on error.
+ * Destroys the environment if 'ring' is not mapped writable. */
+static int
+sys_enter_batch(struct SyscallRing *ring) {
+    if ((uintptr_t)ring & (PAGE_SIZE - 1)) return -E_INVAL;
+    user_mem_assert(curenv, ring, sizeof(*ring), PROT_R | PROT_W | PROT_USER_);
+    static_assert(sizeof(struct SyscallRing) <= PAGE_SIZE, "struct SyscallRing doesn't fit into a page");
+
+    /* Ring indices: sq_head, sq_tail, cq_head, cq_tail */
+    uint32_t idx[4];
+    nosan_memcpy(idx, (void *)ring, sizeof(idx));
+    uint32_t sq_head = idx[0], sq_tail = idx[1], cq_head = idx[2], cq_tail = idx[3];
+    if (sq_tail - sq_head > SYSRING_SQ_ENTRIES ||
+        cq_tail - cq_head > SYSRING_CQ_ENTRIES) return -E_INVAL;
+
+    int count = 0;
+    while (sq_head != sq_tail && cq_tail - cq_head < SYSRING_CQ_ENTRIES) {
+        struct SyscallSqe sqe;
+        nosan_memcpy(&sqe, (void *)&ring->sq[sq_head % SYSRING_SQ_ENTRIES], sizeof(sqe));
+
+        struct SyscallCqe cqe = {.cqe_data = sqe.sqe_data, .cqe_res = -E_INVAL};
+        if (batchable(sqe.sqe_num))
+            cqe.cqe_res = syscall(sqe.sqe_num, sqe.sqe_args[0], sqe.sqe_args[1], sqe.sqe_args[2],
+                                  sqe.sqe_args[3], sqe.sqe_args[4], sqe.sqe_args[5]);
+
+        nosan_memcpy((void *)&ring->cq[cq_tail % SYSRING_CQ_ENTRIES], &cqe, sizeof(cqe));
+        sq_head++, cq_tail++, count++;
+    }
+
+    nosan_memcpy((void *)&ring->sq_head, &sq_head, sizeof(sq_head));
+    nosan_memcpy((void *)&ring->cq_tail, &cq_tail, sizeof(cq_tail));
+    return count;
+}
+
 /* Dispatches to the correct kernel function, passing the arguments. */
 uintptr_t
 syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
@@ -842,10 +1205,20 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
         return 0;
     case SYS_ipc_try_send:
         return sys_ipc_try_send((envid_t)a1, (uint32_t)a2, (uintptr_t)a3, (size_t)a4, (int)a5);
+    case SYS_ipc_send:
+        return sys_ipc_send((envid_t)a1, (uint32_t)a2, (uintptr_t)a3, (size_t)a4, (int)a5);
     case SYS_ipc_recv:
-        return sys_ipc_recv((uintptr_t)a1, (uintptr_t)a2);
+        return sys_ipc_recv((uintptr_t)a1, (uintptr_t)a2, (uint64_t)a3);
+    case SYS_ipc_call:
+        return sys_ipc_call((envid_t)a1, (uint32_t)a2, (uintptr_t)a3, (size_t)a4, (int)a5, (uintptr_t)a6);
+    case SYS_ipc_reply_recv:
+        return sys_ipc_reply_recv((envid_t)a1, (uint32_t)a2, (uintptr_t)a3, (size_t)a4, (int)a5, (uintptr_t)a6);
     case SYS_gettime:
         return sys_gettime();
+    case SYS_sleep:
+        return sys_sleep((uint64_t)a1);
+    case SYS_enter_batch:
+        return sys_enter_batch((struct SyscallRing *)a1);
     case SYS_sigqueue:
         return sys_sigqueue((pid_t)a1, (int)a2, (const union sigval)(void *)a3);
     case SYS_sigwait:
@@ -51,6 +51,7 @@ struct Timer timer_hpet0 = {
         .get_cpu_freq = hpet_cpu_frequency,
         .enable_interrupts = hpet_enable_interrupts_tim0,
         .handle_interrupts = hpet_handle_interrupts_tim0,
+        .set_oneshot = hpet_oneshot_tim0,
 };
 
 struct Timer timer_hpet1 = {
@@ -59,6 +60,7 @@ struct Timer timer_hpet1 = {
         .get_cpu_freq = hpet_cpu_frequency,
         .enable_interrupts = hpet_enable_interrupts_tim1,
         .handle_interrupts = hpet_handle_interrupts_tim1,
+        .set_oneshot = hpet_oneshot_tim1,
 };
 
 struct Timer timer_acpipm = {
@@ -67,6 +69,29 @@ struct Timer timer_acpipm = {
         .get_cpu_freq = pmtimer_cpu_frequency,
 };
 
+/* Whether the scheduling timer is in one-shot mode */
+static bool tick_stopped;
+
+/* Stop the periodic scheduling tick while the CPU is idle.
+ * The timer interrupts once in 'ns' nanoseconds, or not at all if 'ns' is 0.
+ * Timers without one-shot mode keep ticking. */
+void
+timer_tick_stop(uint64_t ns) {
+    if (!timer_for_schedule || !timer_for_schedule->set_oneshot) return;
+
+    timer_for_schedule->set_oneshot(ns);
+    tick_stopped = 1;
+}
+
+/* Go back to the periodic scheduling tick when leaving idle */
+void
+timer_tick_restart(void) {
+    if (!tick_stopped) return;
+
+    timer_for_schedule->enable_interrupts();
+    tick_stopped = 0;
+}
+
 void
 acpi_enable(void) {
     FADT *fadt = get_fadt();
@@ -411,6 +436,9 @@ hpet_enable_interrupts_tim0(void) {
     hpetReg->TIM0_CONF |= HPET_TN_VAL_SET_CNF;
     hpetReg->TIM0_CONF |= (IRQ_TIMER << 9);
 
+    /* With VAL_SET the first write sets the comparator and the second one
+     * the period, so that the tick starts from now after a one-shot */
+    hpetReg->TIM0_COMP = hpetReg->MAIN_CNT + hpetFreq / 2;
     hpetReg->TIM0_COMP = hpetFreq / 2;
 
     pic_irq_unmask(IRQ_TIMER);
@@ -427,11 +455,56 @@ hpet_enable_interrupts_tim1(void) {
     hpetReg->TIM1_CONF |= HPET_TN_VAL_SET_CNF;
     hpetReg->TIM1_CONF |= (IRQ_CLOCK << 9);
 
+    hpetReg->TIM1_COMP = hpetReg->MAIN_CNT + 3 * hpetFreq / 2;
     hpetReg->TIM1_COMP = 3 * hpetFreq / 2;
 
     pic_irq_unmask(IRQ_CLOCK);
 }
 
+/* HPET ticks in ns nanoseconds, at least one */
+static uint64_t
+hpet_ns2ticks(uint64_t ns) {
+    uint64_t ticks = ns / Mega * hpetFreq / kilo + ns % Mega * hpetFreq / Giga;
+    return ticks ? ticks : 1;
+}
+
+/* Set comparator to match 'ticks' from now.  A comparator the main
+ * counter has already passed only matches after the counter wraps,
+ * so check the counter after the write and retry further ahead */
+static void
+hpet_set_comparator(volatile uint64_t *comp, uint64_t ticks) {
+    for (;;) {
+        uint64_t deadline = hpetReg->MAIN_CNT + ticks;
+        *comp = deadline;
+        if ((int64_t)(deadline - hpetReg->MAIN_CNT) > 0) return;
+        ticks *= 2;
+    }
+}
+
+/* Non-periodic mode: the comparator matches once, when the main counter
+ * reaches it.  Disabling the interrupt altogether means "no deadline". */
+void
+hpet_oneshot_tim0(uint64_t ns) {
+    if (!ns) {
+        hpetReg->TIM0_CONF &= ~HPET_TN_INT_ENB_CNF;
+        return;
+    }
+
+    hpetReg->TIM0_CONF = HPET_TN_INT_ENB_CNF | (IRQ_TIMER << 9);
+    hpet_set_comparator(&hpetReg->TIM0_COMP, hpet_ns2ticks(ns));
+}
+
+void
+hpet_oneshot_tim1(uint64_t ns) {
+    if (!ns) {
+        hpetReg->TIM1_CONF &= ~HPET_TN_INT_ENB_CNF;
+        return;
+    }
+
+    hpetReg->TIM1_CONF = HPET_TN_INT_ENB_CNF | (IRQ_CLOCK << 9);
+    hpet_set_comparator(&hpetReg->TIM1_COMP, hpet_ns2ticks(ns));
+}
+
 void
 hpet_handle_interrupts_tim0(void) {
     pic_send_eoi(IRQ_TIMER);
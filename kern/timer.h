@@ -15,6 +15,8 @@ struct Timer {
     uint64_t (*get_cpu_freq)(void);  /* Get CPU frequency */
     void (*enable_interrupts)(void); /* Init timer interrupts */
     void (*handle_interrupts)(void);
+    void (*set_oneshot)(uint64_t ns); /* Interrupt once in ns nanoseconds (never if 0)
+                                       * instead of periodically, until enable_interrupts() */
 };
 
 #define MAX_TIMERS 5
@@ -28,6 +30,9 @@ extern struct Timer timer_hpet1;
 extern struct Timer timer_acpipm;
 extern struct Timer *timer_for_schedule;
 
+void timer_tick_stop(uint64_t ns);
+void timer_tick_restart(void);
+
 #pragma pack(push, 1)
 
 typedef struct {
@@ -200,6 +205,8 @@ void hpet_enable_interrupts_tim1(void);
 uint64_t hpet_cpu_frequency(void);
 void hpet_handle_interrupts_tim0(void);
 void hpet_handle_interrupts_tim1(void);
+void hpet_oneshot_tim0(uint64_t ns);
+void hpet_oneshot_tim1(uint64_t ns);
 
 uint32_t pmtimer_get_timeval(void);
 uint64_t pmtimer_cpu_frequency(void);
@@ -8,6 +8,7 @@
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/console.h>
+#include <kern/cpu.h>
 #include <kern/monitor.h>
 #include <kern/env.h>
 #include <kern/syscall.h>
@@ -18,8 +19,6 @@
 #include <kern/vsyscall.h>
 #include <kern/traceopt.h>
 
-static struct Taskstate ts;
-
 /* For debugging, so print_trapframe can distinguish between printing
  * a saved trapframe and printing the current trapframe and print some
  * additional information in the latter case */
@@ -55,10 +54,10 @@ struct Segdesc32 gdt[2 * NCPU + 7] = {
         [GD_KT32 >> 3] = SEG32(STA_X | STA_R, 0x0, 0xFFFFFFFF, 0),
         /* 0x20 - kernel data segment 32bit */
         [GD_KD32 >> 3] = SEG32(STA_W, 0x0, 0xFFFFFFFF, 0),
-        /* 0x28 - user code segment */
-        [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
-        /* 0x30 - user data segment */
+        /* 0x28 - user data segment */
         [GD_UD >> 3] = SEG64(STA_W, 0x0, 0xFFFFFFFF, 3),
+        /* 0x30 - user code segment */
+        [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
         /* Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
          * in trap_init_percpu() */
         [GD_TSS0 >> 3] = SEG_NULL,
@@ -199,11 +198,11 @@ trap_init_percpu(void) {
 
     /* Setup a TSS so that we get the right stack
      * when we trap to the kernel. */
-    ts.ts_rsp0 = KERN_STACK_TOP;
-    ts.ts_ist1 = KERN_PF_STACK_TOP;
+    cpu_ts.ts_rsp0 = KERN_STACK_TOP;
+    cpu_ts.ts_ist1 = KERN_PF_STACK_TOP;
 
     /* Initialize the TSS slot of the gdt. */
-    *(volatile struct Segdesc64 *)(&gdt[(GD_TSS0 >> 3)]) = SEG64_TSS(STS_T64A, ((uint64_t)&ts), sizeof(struct Taskstate), 0);
+    *(volatile struct Segdesc64 *)(&gdt[(GD_TSS0 >> 3)]) = SEG64_TSS(STS_T64A, ((uint64_t)&cpu_ts), sizeof(struct Taskstate), 0);
 
     /* Load the TSS selector (like other segment selectors, the
      * bottom three bits are special; we leave them 0) */
@@ -211,6 +210,17 @@ trap_init_percpu(void) {
 
     /* Load the IDT */
     lidt(&idt_pd);
+
+#ifndef CONFIG_KSPACE
+    /* Enable SYSCALL/SYSRET.  SYSCALL loads CS from STAR[47:32] and
+     * SS from the next descriptor.  SYSRET to 64-bit mode loads
+     * SS and CS from the two descriptors after STAR[63:48].
+     * Interrupts stay disabled until we are on the kernel stack. */
+    wrmsr(EFER_MSR, rdmsr(EFER_MSR) | EFER_SCE);
+    wrmsr(STAR_MSR, ((uint64_t)(GD_KD32 | 3) << 48) | ((uint64_t)GD_KT << 32));
+    wrmsr(LSTAR_MSR, (uintptr_t)syscall_entry);
+    wrmsr(SFMASK_MSR, FL_IF | FL_DF | FL_TF | FL_AC | FL_NT);
+#endif
 }
 
 void
@@ -304,7 +314,6 @@ trap_dispatch(struct Trapframe *tf) {
         // LAB 5: Your code here
         // LAB 12: Your code here
         timer_for_schedule->handle_interrupts();
-        vsys[VSYS_gettime] = gettime();
         sched_yield();
         return;
         // LAB 11: Your code here
@@ -326,6 +335,51 @@ trap_dispatch(struct Trapframe *tf) {
     }
 }
 
+/* User stack pointer saved by syscall_entry until it is on the kernel stack */
+uintptr_t syscall_user_rsp;
+
+/* Lean dispatcher for system calls made with SYSCALL (see syscall_entry
+ * in kern/trapentry.S).  Unlike trap() it goes straight to syscall()
+ * and returns the trapframe to resume the caller with SYSRET.
+ * It doesn't return if some other environment is scheduled or the
+ * caller's state has to be restored with the generic env_run(). */
+struct Trapframe *
+syscall_fast(struct Trapframe *tf) {
+    /* The environment may have set DF, see trap() */
+    asm volatile("cld" ::
+                         : "cc");
+
+    assert(curenv);
+    env_account_user(curenv);
+
+    curenv->env_tf = *tf;
+    tf = &curenv->env_tf;
+    last_tf = tf;
+
+    /* SYSCALL clobbers RCX, so the second argument is passed in R10 */
+    tf->tf_regs.reg_rax = syscall(
+            tf->tf_regs.reg_rax,
+            tf->tf_regs.reg_rdx,
+            tf->tf_regs.reg_r10,
+            tf->tf_regs.reg_rbx,
+            tf->tf_regs.reg_rdi,
+            tf->tf_regs.reg_rsi,
+            tf->tf_regs.reg_r8);
+
+    if (!curenv || curenv->env_status != ENV_RUNNING)
+        sched_yield();
+
+    /* SYSRET can only return to user code at a canonical address,
+     * and pending signals are delivered by env_run() */
+    tf = &curenv->env_tf;
+    if (tf->tf_cs != (GD_UT | 3) || tf->tf_rip >= MAX_USER_ADDRESS ||
+        curenv->env_sig_queue_start != curenv->env_sig_queue_end)
+        env_run(curenv);
+
+    env_account_resume(curenv);
+    return tf;
+}
+
 /* We do not support recursive page faults in-kernel */
 bool in_page_fault;
 
@@ -345,6 +399,8 @@ trap(struct Trapframe *tf) {
      * the interrupt path */
     assert(!(read_rflags() & FL_IF));
 
+    if (curenv && (tf->tf_cs & 3)) env_account_user(curenv);
+
     if (trace_traps) cprintf("Incoming TRAP[%ld] frame at %p\n", tf->tf_trapno, tf);
     if (trace_traps_more) print_trapframe(tf);
 
@@ -386,12 +442,18 @@ trap(struct Trapframe *tf) {
                     res ? can_redir ? "redirected to user" : "fault" : "resolved by kernel");
         }
         if (!res) {
+            if (curenv && (tf->tf_err & FEC_U)) curenv->env_acct.acct_pgfault_kern++;
             in_page_fault = 0;
             env_pop_tf(tf);
         }
     }
 
-    assert(curenv);
+    if (!curenv) {
+        /* Interrupt that woke the CPU up in sched_halt() */
+        assert(!(tf->tf_cs & 3));
+        trap_dispatch(tf);
+        sched_yield();
+    }
 
     /* Copy trap frame (which is currently on the stack)
      * into 'curenv->env_tf', so that running the environment
@@ -506,6 +568,7 @@ page_fault_handler(struct Trapframe *tf) {
 
     tf->tf_rsp = cur_ux_rsp;
     tf->tf_rip = (uintptr_t)curenv->env_pgfault_upcall;
+    curenv->env_acct.acct_pgfault_user++;
 
     /* And then copy it userspace (nosan_memcpy()) */
     // LAB 9: Your code here:
@@ -44,9 +44,11 @@ void thdlr17(void);
 void thdlr18(void);
 void thdlr19(void);
 void thdlr48(void);
+void syscall_entry(void);
 void kbd_thdlr(void);
 void serial_thdlr(void);
 
+struct Trapframe *syscall_fast(struct Trapframe *tf);
 void signal_handler(struct Trapframe *tf, struct QueuedSignal *qs);
 
 #endif /* JOS_KERN_TRAP_H */
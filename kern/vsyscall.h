@@ -1,6 +1,8 @@
 #ifndef JOS_KERN_VSYSCALL_H
 #define JOS_KERN_VSYSCALL_H
 
-extern volatile int *vsys;
+#include <inc/vsyscall.h>
+
+extern volatile struct Vsys *vsys;
 
 #endif
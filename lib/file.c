@@ -23,9 +23,7 @@ fsipc(unsigned type, void *dstva) {
                 thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
     }
 
-    ipc_send(fsenv, type, &fsipcbuf, PAGE_SIZE, PROT_RW);
-    size_t maxsz = PAGE_SIZE;
-    return ipc_recv(NULL, dstva, &maxsz, NULL);
+    return ipc_call(fsenv, type, &fsipcbuf, PAGE_SIZE, PROT_RW, dstva, NULL);
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -197,6 +195,15 @@ devfile_trunc(struct Fd *fd, off_t newsize) {
     return fsipc(FSREQ_SET_SIZE, NULL);
 }
 
+/* Delete a file */
+int
+remove(const char *path) {
+    if (strlen(path) >= MAXPATHLEN) return -E_BAD_PATH;
+
+    strcpy(fsipcbuf.remove.req_path, path);
+    return fsipc(FSREQ_REMOVE, NULL);
+}
+
 /* Synchronize disk with buffer cache */
 int
 sync(void) {
@@ -205,3 +212,17 @@ sync(void) {
 
     return fsipc(FSREQ_SYNC, NULL);
 }
+
+/* Set the file server write-back policy, negative values keep
+ * the current setting, and fetch its write-back counters */
+int
+fs_writeback(int interval, int ratio, struct Fsret_writeback *stat) {
+    fsipcbuf.writeback.req_interval = interval;
+    fsipcbuf.writeback.req_ratio = ratio;
+
+    int res = fsipc(FSREQ_WRITEBACK, NULL);
+    if (res < 0) return res;
+
+    if (stat) *stat = fsipcbuf.writebackRet;
+    return 0;
+}
@@ -2,32 +2,9 @@
 
 #include <inc/lib.h>
 
-/* Receive a value via IPC and return it.
- * If 'pg' is nonnull, then any page sent by the sender will be mapped at
- *    that address.
- * If 'from_env_store' is nonnull, then store the IPC sender's envid in
- *    *from_env_store.
- * If 'perm_store' is nonnull, then store the IPC sender's page permission
- *    in *perm_store (this is nonzero iff a page was successfully
- *    transferred to 'pg').
- * If the system call fails, then store 0 in *fromenv and *perm (if
- *    they're nonnull) and return the error.
- * Otherwise, return the value sent by the sender
- *
- * Hint:
- *   Use 'thisenv' to discover the value and who sent it.
- *   If 'pg' is null, pass sys_ipc_recv a value that it will understand
- *   as meaning "no page".  (Zero is not the right value, since that's
- *   a perfectly valid place to map a page.) */
-int32_t
-ipc_recv(envid_t *from_env_store, void *pg, size_t *size, int *perm_store) {
-    // LAB 9: Your code here:
-    if (!pg) {
-        pg = (void *)MAX_USER_ADDRESS;
-    }
-
-    int res = sys_ipc_recv(pg, PAGE_SIZE);
-
+/* Fill in ipc_recv() results after a receiving system call returned 'res' */
+static int32_t
+ipc_recv_result(int res, envid_t *from_env_store, void *pg, size_t *size, int *perm_store) {
     if (res) {
         if (from_env_store) {
             *from_env_store = 0;
@@ -55,13 +32,48 @@ ipc_recv(envid_t *from_env_store, void *pg, size_t *size, int *perm_store) {
     }
 }
 
-/* Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
- * This function keeps trying until it succeeds.
- * It should panic() on any error other than -E_IPC_NOT_RECV.
+/* Receive a value via IPC and return it.
+ * If 'pg' is nonnull, then any page sent by the sender will be mapped at
+ *    that address.
+ * If 'from_env_store' is nonnull, then store the IPC sender's envid in
+ *    *from_env_store.
+ * If 'perm_store' is nonnull, then store the IPC sender's page permission
+ *    in *perm_store (this is nonzero iff a page was successfully
+ *    transferred to 'pg').
+ * If the system call fails, then store 0 in *fromenv and *perm (if
+ *    they're nonnull) and return the error.
+ * Otherwise, return the value sent by the sender
  *
  * Hint:
- *   Use sys_yield() to be CPU-friendly.
+ *   Use 'thisenv' to discover the value and who sent it.
  *   If 'pg' is null, pass sys_ipc_recv a value that it will understand
+ *   as meaning "no page".  (Zero is not the right value, since that's
+ *   a perfectly valid place to map a page.) */
+int32_t
+ipc_recv(envid_t *from_env_store, void *pg, size_t *size, int *perm_store) {
+    // LAB 9: Your code here:
+    return ipc_recv_timeout(from_env_store, pg, size, perm_store, 0);
+}
+
+/* Like ipc_recv(), but gives up with -E_TIMEOUT if nothing
+ * arrives within 'timeout' nanoseconds (0 means wait forever). */
+int32_t
+ipc_recv_timeout(envid_t *from_env_store, void *pg, size_t *size, int *perm_store, uint64_t timeout) {
+    if (!pg) {
+        pg = (void *)MAX_USER_ADDRESS;
+    }
+
+    int res = sys_ipc_recv(pg, PAGE_SIZE, timeout);
+
+    return ipc_recv_result(res, from_env_store, pg, size, perm_store);
+}
+
+/* Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
+ * This function blocks in the kernel until the message is received.
+ * It should panic() on any error.
+ *
+ * Hint:
+ *   If 'pg' is null, pass sys_ipc_send a value that it will understand
  *   as meaning "no page".  (Zero is not the right value.) */
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, size_t size, int perm) {
@@ -70,17 +82,61 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, size_t size, int perm) {
         pg = (void *)MAX_USER_ADDRESS;
     }
     
-    int res;
+    int res = sys_ipc_send(to_env, (uint64_t)val, pg, size, perm);
 
-    do {
-        res = sys_ipc_try_send(to_env, (uint64_t)val, pg, size, perm);
-        
-        if (res && res != -E_IPC_NOT_RECV) {
-            panic("ipc_send: failed to send value %u to env %d, errno is %i\n", val, to_env, res);
-        }
+    if (res) {
+        panic("ipc_send: failed to send value %u to env %d, errno is %i\n", val, to_env, res);
+    }
+}
+
+/* Send a request to 'to_env' like ipc_send() and wait for its reply
+ * like ipc_recv(), in a single system call.  The kernel switches
+ * directly to 'to_env' if it is waiting for requests.
+ * Returns the reply value, or the error (reply fields are not stored then). */
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, size_t size, int perm, void *rcv_pg, int *perm_store) {
+    if (!pg) {
+        pg = (void *)MAX_USER_ADDRESS;
+    }
+
+    if (!rcv_pg) {
+        rcv_pg = (void *)MAX_USER_ADDRESS;
+    }
+
+    int res = sys_ipc_call(to_env, (uint64_t)val, pg, size, perm, rcv_pg);
+
+    return ipc_recv_result(res, NULL, rcv_pg, NULL, perm_store);
+}
+
+/* Reply to 'to_env' like ipc_send() and wait for the next request
+ * like ipc_recv(), in a single system call.  Meant for servers
+ * answering ipc_call(): the kernel switches straight back to the client.
+ * Falls back to separate ipc_send() and ipc_recv() if 'to_env'
+ * is not waiting for the reply.  If the reply is rejected, 'to_env'
+ * gets the error as its reply value.  Errors returned are always
+ * the ones of receiving the next request. */
+int32_t
+ipc_reply_recv(envid_t to_env, uint32_t val, void *pg, size_t size, int perm,
+               envid_t *from_env_store, void *rcv_pg, int *perm_store) {
+    void *spg = pg ? pg : (void *)MAX_USER_ADDRESS;
+    void *rpg = rcv_pg ? rcv_pg : (void *)MAX_USER_ADDRESS;
+
+    int res = sys_ipc_reply_recv(to_env, (uint64_t)val, spg, size, perm, rpg);
+
+    if (res == -E_IPC_NOT_RECV) {
+        ipc_send(to_env, val, pg, size, perm);
+        return ipc_recv(from_env_store, rcv_pg, NULL, perm_store);
+    }
+
+    if (res < 0) {
+        /* Nothing was sent or received. Fail the client's ipc_call()
+         * with the error instead of leaving it blocked forever,
+         * then wait for the next request on its own. */
+        if (res != -E_BAD_ENV) ipc_send(to_env, res, NULL, 0, 0);
+        return ipc_recv(from_env_store, rcv_pg, NULL, perm_store);
+    }
 
-        sys_yield();
-    } while (res); 
+    return ipc_recv_result(res, from_env_store, rpg, NULL, perm_store);
 }
 
 /* Find the first environment of the given type.  We'll use this to
@@ -286,16 +286,17 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
     /* Allocate memsz - filesz in child */
     filesz = ROUNDUP(filesz, PAGE_SIZE);
     // ROUNDUP(memsz - filesz, PAGE_SIZE)
-    if (filesz < memsz && (res = sys_alloc_region(child, (void *)(va + filesz), memsz, perm))) {
-        return res;
+    if (filesz < memsz) {
+        batch_alloc_region(child, (void *)(va + filesz), memsz, perm);
     }
 
-    if (!filesz) {
-        return 0;
+    /* Allocate filesz in parent to UTEMP,
+     * in the same kernel entry as the child allocation */
+    if (filesz) {
+        batch_alloc_region(CURENVID, UTEMP, filesz, PROT_RW | PROT_X | perm);
     }
 
-    /* Allocate filesz in parent to UTEMP */
-    if ((res = sys_alloc_region(CURENVID, UTEMP, filesz, PROT_RW | PROT_X | perm))) {
+    if ((res = batch_submit()) || !filesz) {
         return res;
     }
 
@@ -308,13 +309,10 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
     res = readn(fd, (void *)UTEMP, filesz);
     assert(res == filesz);
 
-    /* Map read section conents to child */
-    if ((res = sys_map_region(CURENVID, (void *)UTEMP, child, (void *)va, filesz, perm))) {
-        return res;
-    }
-
-    /* Unmap it from parent */
-    if ((res = sys_unmap_region(CURENVID, (void *)UTEMP, filesz))) {
+    /* Map read section conents to child and unmap it from parent */
+    batch_map_region(CURENVID, (void *)UTEMP, child, (void *)va, filesz, perm);
+    batch_unmap_region(CURENVID, (void *)UTEMP, filesz);
+    if ((res = batch_submit())) {
         return res;
     }
 
@@ -115,8 +115,8 @@ strfind(const char *str, int ch) {
 
 
 #if ASM
-void *
-memset(void *v, int c, size_t n) {
+static void *
+memset_stosq(void *v, int c, size_t n) {
     uint8_t *ptr = v;
     ssize_t ni = n;
 
@@ -178,10 +178,12 @@ memmove(void *dst, const void *src, size_t n) {
     return dst;
 }
 
+void *(*memset_impl)(void *, int, size_t) = memset_stosq;
+
 #else
 
-void *
-memset(void *v, int c, size_t n) {
+static void *
+memset_bytes(void *v, int c, size_t n) {
     char *ptr = v;
 
     while (n-- > 0) *ptr++ = c;
@@ -203,11 +205,44 @@ memmove(void *dst, const void *src, size_t n) {
 
     return dst;
 }
+
+void *(*memset_impl)(void *, int, size_t) = memset_bytes;
 #endif
 
+void *(*memcpy_impl)(void *, const void *, size_t) = memmove;
+
+/* Variants for CPUs with fast REP MOVSB/STOSB (ERMS) */
+void *
+memset_stosb(void *v, int c, size_t n) {
+    void *ptr = v;
+    asm volatile("cld; rep stosb\n"
+                 : "+D"(ptr), "+c"(n)
+                 : "a"(c)
+                 : "cc", "memory");
+    return v;
+}
+
+void *
+memcpy_movsb(void *dst, const void *src, size_t n) {
+    /* Callers may rely on memcpy() handling overlap like memmove() */
+    if (src < dst && (const char *)src + n > (char *)dst) return memmove(dst, src, n);
+
+    void *d = dst;
+    asm volatile("cld; rep movsb\n"
+                 : "+D"(d), "+S"(src), "+c"(n)
+                 :
+                 : "cc", "memory");
+    return dst;
+}
+
+void *
+memset(void *v, int c, size_t n) {
+    return memset_impl(v, c, n);
+}
+
 void *
 memcpy(void *dst, const void *src, size_t n) {
-    return memmove(dst, src, n);
+    return memcpy_impl(dst, src, n);
 }
 
 int
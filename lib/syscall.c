@@ -10,16 +10,21 @@ syscall(uintptr_t num, bool check, uintptr_t a1, uintptr_t a2, uintptr_t a3, uin
     /* Generic system call.
      * Pass system call number in RAX,
      * Up to six parameters in RDX, RCX, RBX, RDI, RSI and R8.
+     * SYSCALL clobbers RCX and R11, so when it is used
+     * the second parameter goes in R10 instead of RCX.
      *
      * Registers are assigned using GCC externsion
      */
 
     register uintptr_t _a0 asm("rax") = num,
-                           _a1 asm("rdx") = a1, _a2 asm("rcx") = a2,
+                           _a1 asm("rdx") = a1,
                            _a3 asm("rbx") = a3, _a4 asm("rdi") = a4,
                            _a5 asm("rsi") = a5, _a6 asm("r8") = a6;
 
-    /* Interrupt kernel with T_SYSCALL.
+#ifndef CONFIG_KSPACE
+    register uintptr_t _a2 asm("r10") = a2;
+
+    /* Enter the kernel with SYSCALL (see syscall_entry in kern/trapentry.S).
      *
      * The "volatile" tells the assembler not to optimize
      * this instruction away just because we don't use the
@@ -29,10 +34,20 @@ syscall(uintptr_t num, bool check, uintptr_t a1, uintptr_t a2, uintptr_t a3, uin
      * potentially change the condition codes and arbitrary
      * memory locations. */
 
+    asm volatile("syscall\n"
+                 : "=a"(ret)
+                 : "r"(_a0), "r"(_a1), "r"(_a2), "r"(_a3), "r"(_a4), "r"(_a5), "r"(_a6)
+                 : "rcx", "r11", "cc", "memory");
+#else
+    register uintptr_t _a2 asm("rcx") = a2;
+
+    /* Interrupt kernel with T_SYSCALL. */
+
     asm volatile("int %1\n"
                  : "=a"(ret)
                  : "i"(T_SYSCALL), "r"(_a0), "r"(_a1), "r"(_a2), "r"(_a3), "r"(_a4), "r"(_a5), "r"(_a6)
                  : "cc", "memory");
+#endif
 
     if (check && ret > 0) {
         panic("syscall %zd returned %zd (> 0)", num, ret);
@@ -143,8 +158,31 @@ sys_ipc_try_send(envid_t envid, uintptr_t value, void *srcva, size_t size, int p
 }
 
 int
-sys_ipc_recv(void *dstva, size_t size) {
-    int res = syscall(SYS_ipc_recv, 1, (uintptr_t)dstva, size, 0, 0, 0, 0);
+sys_ipc_send(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm) {
+    return syscall(SYS_ipc_send, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
+}
+
+int
+sys_ipc_recv(void *dstva, size_t size, uint64_t timeout) {
+    int res = syscall(SYS_ipc_recv, 1, (uintptr_t)dstva, size, timeout, 0, 0, 0);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    if (!res) platform_asan_unpoison(dstva, thisenv->env_ipc_maxsz);
+#endif
+    return res;
+}
+
+int
+sys_ipc_call(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm, void *dstva) {
+    int res = syscall(SYS_ipc_call, 0, envid, value, (uintptr_t)srcva, size, perm, (uintptr_t)dstva);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    if (!res) platform_asan_unpoison(dstva, thisenv->env_ipc_maxsz);
+#endif
+    return res;
+}
+
+int
+sys_ipc_reply_recv(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm, void *dstva) {
+    int res = syscall(SYS_ipc_reply_recv, 0, envid, value, (uintptr_t)srcva, size, perm, (uintptr_t)dstva);
 #ifdef SANITIZE_USER_SHADOW_BASE
     if (!res) platform_asan_unpoison(dstva, thisenv->env_ipc_maxsz);
 #endif
@@ -156,6 +194,16 @@ sys_gettime(void) {
     return syscall(SYS_gettime, 0, 0, 0, 0, 0, 0, 0);
 }
 
+int
+sys_sleep(uint64_t ns) {
+    return syscall(SYS_sleep, 0, ns, 0, 0, 0, 0, 0);
+}
+
+int
+sys_enter_batch(struct SyscallRing *ring) {
+    return syscall(SYS_enter_batch, 0, (uintptr_t)ring, 0, 0, 0, 0, 0);
+}
+
 int 
 sys_sigqueue(pid_t pid, int sig, const union sigval value) {
     return syscall(SYS_sigqueue, 1, (uintptr_t)pid, (uintptr_t)sig, (uintptr_t)value.sival_ptr, 0, 0, 0);
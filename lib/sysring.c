@@ -0,0 +1,83 @@
+/* Batched system calls through the shared syscall ring (see inc/sysring.h).
+ *
+ * Calls are queued with batch_*() and executed by the kernel on the next
+ * batch_submit(), or earlier if the submission ring fills up.
+ * Queued calls are not checked individually: batch_submit() reports
+ * the first error of everything submitted since the previous call. */
+
+#include <inc/lib.h>
+
+static struct SyscallRing ring __attribute__((aligned(PAGE_SIZE)));
+static int batch_error;
+
+/* Collect completions posted by the kernel */
+static void
+batch_reap(void) {
+    while (ring.cq_head != ring.cq_tail) {
+        struct SyscallCqe *cqe = &ring.cq[ring.cq_head % SYSRING_CQ_ENTRIES];
+#ifdef SANITIZE_USER_SHADOW_BASE
+        /* Completions are posted in submission order */
+        struct SyscallSqe *sqe = &ring.sq[cqe->cqe_data % SYSRING_SQ_ENTRIES];
+        if (!cqe->cqe_res) {
+            if (sqe->sqe_num == SYS_alloc_region && sqe->sqe_args[0] == CURENVID)
+                platform_asan_unpoison((void *)sqe->sqe_args[1], sqe->sqe_args[2]);
+            if (sqe->sqe_num == SYS_map_region && sqe->sqe_args[2] == CURENVID)
+                platform_asan_unpoison((void *)sqe->sqe_args[3], sqe->sqe_args[4]);
+        }
+#endif
+        if (cqe->cqe_res < 0 && !batch_error) batch_error = cqe->cqe_res;
+        ring.cq_head++;
+    }
+}
+
+/* Queue system call 'num', flushing the ring first if it is full */
+void
+batch_syscall(uintptr_t num, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
+    if (ring.sq_tail - ring.sq_head == SYSRING_SQ_ENTRIES) {
+        int res = batch_submit();
+        if (res < 0 && !batch_error) batch_error = res;
+    }
+
+    struct SyscallSqe *sqe = &ring.sq[ring.sq_tail % SYSRING_SQ_ENTRIES];
+    *sqe = (struct SyscallSqe){
+            .sqe_num = num,
+            .sqe_args = {a1, a2, a3, a4, a5, a6},
+            .sqe_data = ring.sq_tail,
+    };
+    ring.sq_tail++;
+}
+
+void
+batch_alloc_region(envid_t envid, void *va, size_t size, int perm) {
+    batch_syscall(SYS_alloc_region, envid, (uintptr_t)va, size, perm, 0, 0);
+}
+
+void
+batch_map_region(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, size_t size, int perm) {
+    batch_syscall(SYS_map_region, srcenv, (uintptr_t)srcva, dstenv, (uintptr_t)dstva, size, perm);
+}
+
+void
+batch_unmap_region(envid_t envid, void *va, size_t size) {
+    batch_syscall(SYS_unmap_region, envid, (uintptr_t)va, size, 0, 0, 0);
+}
+
+/* Execute all queued system calls.
+ * Returns 0 if all of them succeeded, otherwise the first error. */
+int
+batch_submit(void) {
+    while (ring.sq_head != ring.sq_tail) {
+        int res = sys_enter_batch(&ring);
+        if (res < 0) {
+            /* Drop the rest of the batch */
+            ring.sq_head = ring.sq_tail = ring.cq_head = ring.cq_tail;
+            batch_error = 0;
+            return res;
+        }
+        batch_reap();
+    }
+
+    int res = batch_error;
+    batch_error = 0;
+    return res;
+}
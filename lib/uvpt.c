@@ -50,6 +50,12 @@ is_page_dirty(void *va) {
     return pte & PTE_D;
 }
 
+bool
+is_page_accessed(void *va) {
+    pte_t pte = get_uvpt_entry(va);
+    return pte & PTE_A;
+}
+
 bool
 is_page_present(void *va) {
     return get_uvpt_entry(va) & PTE_P;
@@ -1,14 +1,74 @@
 #include <inc/vsyscall.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
 
-static inline uint64_t
-vsyscall(int num) {
-    // LAB 12: Your code here
-    (void)num;
-    return num < NSYSCALLS ? (int)vsys[num] : -E_INVAL;
+/* Read a consistent snapshot of the clock fields, see struct Vsys */
+static void
+vsys_clock(uint64_t *base, uint64_t *freq, int32_t *boot_time) {
+    uint32_t seq;
+
+    do {
+        while ((seq = vsys.vsys_seq) & 1)
+            asm volatile("pause");
+        *base = vsys.vsys_tsc_base;
+        *freq = vsys.vsys_tsc_freq;
+        *boot_time = vsys.vsys_boot_time;
+    } while (seq != vsys.vsys_seq);
+}
+
+int
+vsys_clock_gettime(int clock_id, struct timespec *ts) {
+    uint64_t base, freq;
+    int32_t boot_time;
+
+    if (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC)
+        return -E_INVAL;
+
+    vsys_clock(&base, &freq, &boot_time);
+    if (!freq) return -E_INVAL;
+
+    uint64_t ns = tsc2ns(read_tsc() - base, freq);
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    if (clock_id == CLOCK_REALTIME)
+        ts->tv_sec += boot_time;
+
+    return 0;
+}
+
+/* Sleep for the interval in 'req' */
+int
+nanosleep(const struct timespec *req) {
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= (int64_t)NSEC_PER_SEC)
+        return -E_INVAL;
+
+    return sys_sleep(req->tv_sec * NSEC_PER_SEC + req->tv_nsec);
 }
 
 int
 vsys_gettime(void) {
-    return vsyscall(VSYS_gettime);
+    struct timespec ts;
+    int res = vsys_clock_gettime(CLOCK_REALTIME, &ts);
+
+    return res < 0 ? res : (int)ts.tv_sec;
+}
+
+envid_t
+vsys_getenvid(void) {
+    return vsys.vsys_curenv;
+}
+
+/* Nanoseconds envid has been running, or 0 if it doesn't exist */
+uint64_t
+vsys_env_runtime(envid_t envid) {
+    uint64_t base, freq;
+    int32_t boot_time;
+
+    if (envs[ENVX(envid)].env_id != envid)
+        return 0;
+
+    vsys_clock(&base, &freq, &boot_time);
+    if (!freq) return 0;
+
+    return tsc2ns(vsys.vsys_runtime[ENVX(envid)], freq);
 }
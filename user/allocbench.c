@@ -0,0 +1,110 @@
+/* Measures block allocation throughput: fills the disk with
+ * files of FILL_BLOCKS blocks, frees the last block of each
+ * to leave it ~90% full with scattered holes, then appends
+ * to a new file and reports how fast and how contiguously
+ * its blocks were allocated. The files are removed
+ * at the end. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define FILL_BLOCKS 8
+
+char buf[BLKSIZE];
+
+static uint64_t
+now_us(void) {
+    return tsc2us(read_tsc(), vsys.vsys_tsc_freq);
+}
+
+static void
+report(const char *phase, size_t nblocks, uint64_t us,
+       struct Fsret_writeback *before, struct Fsret_writeback *after) {
+    uint64_t writes = after->ret_writes - before->ret_writes;
+    uint64_t written = after->ret_written - before->ret_written;
+
+    printf("allocbench: %s: %zu blocks in %lu us, %lu blocks/s, %lu blocks per write\n",
+           phase, nblocks, (unsigned long)us,
+           (unsigned long)(us ? nblocks * USEC_PER_SEC / us : 0),
+           (unsigned long)(writes ? written / writes : 0));
+}
+
+/* Append up to 'nblocks' blocks to 'f', returns number appended */
+static size_t
+append(int f, size_t nblocks) {
+    size_t n = 0;
+
+    while (n < nblocks && write(f, buf, BLKSIZE) == BLKSIZE)
+        n++;
+    return n;
+}
+
+static int
+truncate_path(const char *path, off_t size) {
+    int f = open(path, O_RDWR);
+    if (f < 0) return f;
+
+    int res = ftruncate(f, size);
+    close(f);
+    return res;
+}
+
+void
+umain(int argc, char **argv) {
+    struct Fsret_writeback before, after;
+    char path[MAXPATHLEN];
+    size_t nfiles = 0, nblocks = 0;
+    binaryname = "allocbench";
+
+    memset(buf, 'a', sizeof(buf));
+
+    /* Fill the disk */
+    sync();
+    fs_writeback(-1, -1, &before);
+    uint64_t start = now_us();
+    for (;; nfiles++) {
+        snprintf(path, sizeof(path), "/allocbench%zu", nfiles);
+        int f = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+        if (f < 0) break;
+
+        size_t n = append(f, FILL_BLOCKS);
+        close(f);
+        nblocks += n;
+        if (n < FILL_BLOCKS) {
+            nfiles++;
+            break;
+        }
+    }
+    sync();
+    fs_writeback(-1, -1, &after);
+    report("fill", nblocks, now_us() - start, &before, &after);
+
+    /* Free the last block of each file */
+    size_t nholes = 0;
+    for (size_t i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "/allocbench%zu", i);
+        if (!truncate_path(path, (FILL_BLOCKS - 1) * BLKSIZE)) nholes++;
+    }
+    sync();
+    printf("allocbench: %zu files, %zu free blocks left in holes\n", nfiles, nholes);
+
+    /* Append into the holes */
+    int f = open("/allocbench.append", O_WRONLY | O_CREAT | O_TRUNC);
+    if (f < 0) panic("can't create /allocbench.append: %i", f);
+
+    fs_writeback(-1, -1, &before);
+    start = now_us();
+    nblocks = append(f, nholes / 2);
+    close(f);
+    sync();
+    fs_writeback(-1, -1, &after);
+    report("append at 90% full", nblocks, now_us() - start, &before, &after);
+
+    /* Give the space back */
+    remove("/allocbench.append");
+    for (size_t i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "/allocbench%zu", i);
+        remove(path);
+    }
+    sync();
+}
@@ -0,0 +1,36 @@
+/* Cost of 10000 sys_map_region() calls issued one by one
+ * compared with the same calls batched through the syscall ring */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NMAPS 10000
+
+#define SRC ((void *)UTEMP)
+#define DST ((void *)(UTEMP + PAGE_SIZE))
+
+void
+umain(int argc, char **argv) {
+    uint64_t start, cycles_single, cycles_batch;
+    int i, res;
+
+    if ((res = sys_alloc_region(CURENVID, SRC, PAGE_SIZE, PROT_RW)) < 0)
+        panic("sys_alloc_region: %i", res);
+
+    start = read_tsc();
+    for (i = 0; i < NMAPS; i++)
+        if ((res = sys_map_region(CURENVID, SRC, CURENVID, DST, PAGE_SIZE, PROT_RW)) < 0)
+            panic("sys_map_region: %i", res);
+    cycles_single = read_tsc() - start;
+
+    start = read_tsc();
+    for (i = 0; i < NMAPS; i++)
+        batch_map_region(CURENVID, SRC, CURENVID, DST, PAGE_SIZE, PROT_RW);
+    if ((res = batch_submit()) < 0)
+        panic("batch_submit: %i", res);
+    cycles_batch = read_tsc() - start;
+
+    cprintf("batchbench: one by one: %lu cycles per map\n", (unsigned long)(cycles_single / NMAPS));
+    cprintf("batchbench: batched:    %lu cycles per map (%d per kernel entry)\n",
+            (unsigned long)(cycles_batch / NMAPS), SYSRING_SQ_ENTRIES);
+}
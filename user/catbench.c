@@ -0,0 +1,40 @@
+/* Reads a file the way cat does, discarding the data,
+ * and reports the time spent. The first run after boot
+ * measures reads from disk, the second one cached reads */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+char buf[8192];
+
+static void
+catbench(const char *path) {
+    size_t total = 0;
+    long n;
+
+    int f = open(path, O_RDONLY);
+    if (f < 0) {
+        printf("can't open %s: %i\n", path, f);
+        return;
+    }
+
+    uint64_t start = read_tsc();
+    while ((n = read(f, buf, (long)sizeof(buf))) > 0)
+        total += n;
+    uint64_t us = tsc2us(read_tsc() - start, vsys.vsys_tsc_freq);
+    close(f);
+
+    if (n < 0) panic("error reading %s: %i", path, (int)n);
+
+    printf("catbench: %s: %zu KB in %lu us, %lu KB/s\n", path, total >> 10,
+           (unsigned long)us, (unsigned long)(us ? (total >> 10) * USEC_PER_SEC / us : 0));
+}
+
+void
+umain(int argc, char **argv) {
+    binaryname = "catbench";
+    const char *path = argc > 1 ? argv[1] : "/bigfile";
+
+    catbench(path);
+    catbench(path);
+}
@@ -0,0 +1,58 @@
+/* Fork with 64MB of memory backed by 2MB pages and let the
+ * child write one byte into a scattered 4K page of each of them.
+ * Reports write fault latency and memory made private */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION      ((uint8_t *)0x1000000000)
+#define REGION_SIZE (32 * HUGE_PAGE_SIZE)
+#define NHUGE       (REGION_SIZE / HUGE_PAGE_SIZE)
+
+void
+umain(int argc, char **argv) {
+    envid_t child;
+    int res;
+
+    if ((res = sys_alloc_region(CURENVID, REGION, REGION_SIZE, PROT_RW)) < 0)
+        panic("sys_alloc_region: %i", res);
+    /* Remapping lazy region onto itself without PROT_LAZY
+     * makes it private, still backed by 2MB pages */
+    if ((res = sys_map_region(CURENVID, REGION, CURENVID, REGION, REGION_SIZE, PROT_RW)) < 0)
+        panic("sys_map_region: %i", res);
+    for (size_t i = 0; i < REGION_SIZE; i += PAGE_SIZE)
+        REGION[i] = (uint8_t)(i >> 12);
+
+    if ((child = fork()) < 0) panic("fork: %i", child);
+
+    if (!child) {
+        const volatile struct EnvAcct *acct = &thisenv->env_acct;
+        uint64_t bytes0 = acct->acct_fault_bytes, total = 0, worst = 0;
+        uint32_t seed = 12345;
+
+        for (size_t i = 0; i < NHUGE; i++) {
+            seed = seed * 1103515245 + 12345;
+            size_t off = i * HUGE_PAGE_SIZE + ((seed >> 8) % (HUGE_PAGE_SIZE / PAGE_SIZE)) * PAGE_SIZE;
+
+            uint64_t start = read_tsc();
+            REGION[off]++;
+            uint64_t cycles = read_tsc() - start;
+
+            total += cycles;
+            worst = MAX(worst, cycles);
+            if (REGION[off] != (uint8_t)((off >> 12) + 1)) panic("cowbench: bad byte at %zx", off);
+        }
+
+        cprintf("cowbench: %zu write faults, %lu us avg, %lu us max\n", (size_t)NHUGE,
+                (unsigned long)tsc2us(total / NHUGE, vsys.vsys_tsc_freq), (unsigned long)tsc2us(worst, vsys.vsys_tsc_freq));
+        cprintf("cowbench: %lu KB made private of %lu KB shared\n",
+                (unsigned long)((acct->acct_fault_bytes - bytes0) >> 10), (unsigned long)(REGION_SIZE >> 10));
+        return;
+    }
+
+    wait(child);
+
+    /* Parent's copy must be unaffected */
+    for (size_t i = 0; i < REGION_SIZE; i += PAGE_SIZE)
+        if (REGION[i] != (uint8_t)(i >> 12)) panic("cowbench: parent byte changed at %zx", i);
+}
@@ -0,0 +1,65 @@
+/* Creates many small files and reports how many blocks the file
+ * server wrote for them, first writing synchronously on every
+ * close and then with deferred write-back. The files are
+ * removed after each run */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES    1000
+#define FILE_SIZE 100
+
+char buf[FILE_SIZE];
+
+static void
+createbench(const char *prefix, int interval) {
+    struct Fsret_writeback before, after;
+    char path[MAXPATHLEN];
+    int res;
+
+    if ((res = fs_writeback(interval, -1, NULL)) < 0)
+        panic("fs_writeback: %i", res);
+    sync();
+    fs_writeback(-1, -1, &before);
+
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof(path), "/%s%d", prefix, i);
+        int f = open(path, O_WRONLY | O_CREAT);
+        if (f < 0) panic("can't create %s: %i", path, f);
+        if ((res = write(f, buf, sizeof(buf))) != sizeof(buf))
+            panic("write %s: %i", path, res);
+        close(f);
+    }
+    sync();
+    uint64_t us = tsc2us(read_tsc() - start, vsys.vsys_tsc_freq);
+    fs_writeback(-1, -1, &after);
+
+    uint64_t written = after.ret_written - before.ret_written;
+    printf("createbench: interval %d ms: %d files of %d bytes in %lu us, "
+           "%lu blocks in %lu writes, amplification %lu.%02lu\n",
+           interval, NFILES, FILE_SIZE, (unsigned long)us,
+           (unsigned long)written, (unsigned long)(after.ret_writes - before.ret_writes),
+           (unsigned long)(written * BLKSIZE / (NFILES * FILE_SIZE)),
+           (unsigned long)(written * BLKSIZE * 100 / (NFILES * FILE_SIZE) % 100));
+
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof(path), "/%s%d", prefix, i);
+        if ((res = remove(path)) < 0) panic("can't remove %s: %i", path, res);
+    }
+    sync();
+}
+
+void
+umain(int argc, char **argv) {
+    struct Fsret_writeback policy;
+    binaryname = "createbench";
+
+    memset(buf, 'x', sizeof(buf));
+    if (fs_writeback(-1, -1, &policy) < 0) panic("fs_writeback");
+
+    createbench("cbsync", 0);
+    createbench("cbwb", policy.ret_interval ? (int)policy.ret_interval : 1000);
+
+    fs_writeback(policy.ret_interval, policy.ret_ratio, NULL);
+}
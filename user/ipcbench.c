@@ -0,0 +1,79 @@
+/* Ping-pong round trips between one server and N concurrent clients,
+ * comparing blocking ipc_send() with spinning on sys_ipc_try_send(). */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUNDS 200
+
+static const int nclients[] = {1, 4, 16};
+
+static envid_t clients[16];
+
+/* The old ipc_send(): retry sys_ipc_try_send() and yield until it succeeds */
+static void
+send_spin(envid_t to_env, uint32_t val) {
+    int res;
+
+    while ((res = sys_ipc_try_send(to_env, val, (void *)MAX_USER_ADDRESS, 0, 0))) {
+        if (res != -E_IPC_NOT_RECV)
+            panic("sys_ipc_try_send: %i", res);
+        sys_yield();
+    }
+}
+
+static void
+send(bool spin, envid_t to_env, uint32_t val) {
+    if (spin)
+        send_spin(to_env, val);
+    else
+        ipc_send(to_env, val, NULL, 0, 0);
+}
+
+static void
+run(bool spin, int n) {
+    envid_t server = sys_getenvid();
+    int i;
+
+    for (i = 0; i < n; i++) {
+        envid_t id = fork();
+        if (id < 0) panic("fork: %i", id);
+        if (!id) {
+            for (uint32_t k = 0; k < NROUNDS; k++) {
+                send(spin, server, k);
+                ipc_recv(NULL, NULL, NULL, NULL);
+            }
+            exit();
+        }
+        clients[i] = id;
+    }
+
+    uint64_t start = read_tsc();
+    for (i = 0; i < n * NROUNDS; i++) {
+        envid_t who;
+        uint32_t val = ipc_recv(&who, NULL, NULL, NULL);
+        send(spin, who, val);
+    }
+    uint64_t cycles = read_tsc() - start;
+
+    /* Clients' env_runs are left in envs[] after they exit
+     * and tell how often they had to be scheduled */
+    uint64_t runs = 0;
+    for (i = 0; i < n; i++) {
+        wait(clients[i]);
+        runs += envs[ENVX(clients[i])].env_runs;
+    }
+
+    cprintf("ipcbench: %s, %2d clients: %lu cycles per round trip, %lu client runs for %d round trips\n",
+            spin ? "spin " : "block", n,
+            (unsigned long)(cycles / ((uint64_t)n * NROUNDS)),
+            (unsigned long)runs, n * NROUNDS);
+}
+
+void
+umain(int argc, char **argv) {
+    for (size_t k = 0; k < sizeof(nclients) / sizeof(*nclients); k++) {
+        run(1, nclients[k]);
+        run(0, nclients[k]);
+    }
+}
@@ -0,0 +1,36 @@
+/* Null system call latency: sys_getenvid() through SYSCALL
+ * compared with the 'int $T_SYSCALL' path */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCALLS 100000
+
+static envid_t
+getenvid_int(void) {
+    envid_t ret;
+    asm volatile("int %1"
+                 : "=a"(ret)
+                 : "i"(T_SYSCALL), "a"(SYS_getenvid)
+                 : "cc", "memory");
+    return ret;
+}
+
+void
+umain(int argc, char **argv) {
+    uint64_t start, cycles_int, cycles_fast;
+    int i;
+
+    start = read_tsc();
+    for (i = 0; i < NCALLS; i++)
+        getenvid_int();
+    cycles_int = read_tsc() - start;
+
+    start = read_tsc();
+    for (i = 0; i < NCALLS; i++)
+        sys_getenvid();
+    cycles_fast = read_tsc() - start;
+
+    cprintf("nullsyscall: int $T_SYSCALL: %lu cycles per call\n", (unsigned long)(cycles_int / NCALLS));
+    cprintf("nullsyscall: syscall:        %lu cycles per call\n", (unsigned long)(cycles_fast / NCALLS));
+}
@@ -0,0 +1,43 @@
+/* Times sys_region_refs() over a 1GB region with 1% of pages
+ * touched and over an unmapped 1GB region */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION      ((uint8_t *)0x1000000000)
+#define HOLE        ((uint8_t *)0x2000000000)
+#define REGION_SIZE (1ULL << 30)
+#define STRIDE      (100 * PAGE_SIZE)
+#define ROUNDS      100
+
+/* Negative 'expect' accepts any positive result */
+static uint64_t
+time_refs(void *va, size_t size, int expect) {
+    uint64_t start = read_tsc();
+    for (int i = 0; i < ROUNDS; i++) {
+        int res = sys_region_refs(va, size);
+        if (expect >= 0 ? res != expect : res <= 0) panic("sys_region_refs(%p): %d", va, res);
+    }
+    return (read_tsc() - start) / ROUNDS;
+}
+
+void
+umain(int argc, char **argv) {
+    int res;
+
+    if ((res = sys_alloc_region(CURENVID, REGION, REGION_SIZE, PROT_RW)) < 0)
+        panic("sys_alloc_region: %i", res);
+    for (size_t off = 0; off < REGION_SIZE; off += STRIDE)
+        REGION[off] = 1;
+
+    uint64_t mapped = time_refs(REGION, REGION_SIZE, -1);
+    uint64_t hole = time_refs(HOLE, REGION_SIZE, 0);
+
+    cprintf("refsbench: mapped 1GB: %lu cycles, %lu us per call\n",
+            (unsigned long)mapped, (unsigned long)tsc2us(mapped, vsys.vsys_tsc_freq));
+    cprintf("refsbench: unmapped 1GB: %lu cycles, %lu us per call\n",
+            (unsigned long)hole, (unsigned long)tsc2us(hole, vsys.vsys_tsc_freq));
+
+    if ((res = sys_unmap_region(CURENVID, REGION, REGION_SIZE)) < 0)
+        panic("sys_unmap_region: %i", res);
+}
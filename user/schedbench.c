@@ -0,0 +1,41 @@
+/* Measure yield-to-yield latency with many runnable environments */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUNDS 100
+
+static const int nenvs[] = {10, 100, 1000};
+
+static envid_t children[1000];
+
+void
+umain(int argc, char **argv) {
+    for (size_t k = 0; k < sizeof(nenvs) / sizeof(*nenvs); k++) {
+        int n = nenvs[k], i;
+
+        /* Fork n - 1 spinners, together with us there are n live envs */
+        for (i = 0; i < n - 1; i++) {
+            envid_t id = fork();
+            if (id < 0) panic("fork: %i", id);
+            if (!id) {
+                for (;;) sys_yield();
+            }
+            children[i] = id;
+        }
+
+        /* Let every child make its first run */
+        sys_yield();
+
+        uint64_t start = read_tsc();
+        for (i = 0; i < NROUNDS; i++)
+            sys_yield();
+        uint64_t cycles = read_tsc() - start;
+
+        cprintf("schedbench: %d envs: %lu cycles per yield\n",
+                n, (unsigned long)(cycles / ((uint64_t)NROUNDS * n)));
+
+        for (i = 0; i < n - 1; i++)
+            sys_env_destroy(children[i]);
+    }
+}
@@ -0,0 +1,71 @@
+/* Sleep and IPC timeouts.  Also checks that the cost of a yield
+ * doesn't depend on the number of sleeping environments. */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUNDS   1000
+#define NSLEEPERS 1000
+
+#define MSEC (1000 * 1000ULL)
+
+static envid_t children[NSLEEPERS];
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    vsys_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * MSEC + ts.tv_nsec;
+}
+
+static uint64_t
+yield_cycles(void) {
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NROUNDS; i++)
+        sys_yield();
+    return (read_tsc() - start) / NROUNDS;
+}
+
+void
+umain(int argc, char **argv) {
+    int i, n = 0, res;
+
+    /* Sleeps at least as long as asked */
+    uint64_t start = now_ns();
+    sys_sleep(20 * MSEC);
+    uint64_t slept = now_ns() - start;
+    if (slept < 20 * MSEC) panic("slept %lu ns instead of 20ms", (unsigned long)slept);
+    cprintf("sleepers: sys_sleep(20ms) took %lu us\n", (unsigned long)(slept / 1000));
+
+    /* Nobody sends us anything */
+    start = now_ns();
+    res = ipc_recv_timeout(NULL, NULL, NULL, NULL, 10 * MSEC);
+    if (res != -E_TIMEOUT) panic("ipc_recv_timeout: %i", res);
+    cprintf("sleepers: ipc_recv timed out after %lu us\n", (unsigned long)((now_ns() - start) / 1000));
+
+    uint64_t alone = yield_cycles();
+
+    /* Children sleep until well after the measurement */
+    for (i = 0; i < NSLEEPERS; i++) {
+        envid_t id = fork();
+        if (id < 0) break;
+        if (!id) {
+            sys_sleep(10000 * MSEC);
+            exit();
+        }
+        children[n++] = id;
+    }
+
+    /* Wait for all of them to go to sleep */
+    for (i = 0; i < n; i++)
+        while (envs[ENVX(children[i])].env_status != ENV_NOT_RUNNABLE)
+            sys_yield();
+
+    uint64_t crowded = yield_cycles();
+
+    cprintf("sleepers: 0 sleepers: %lu cycles per yield\n", (unsigned long)alone);
+    cprintf("sleepers: %d sleepers: %lu cycles per yield\n", n, (unsigned long)crowded);
+
+    for (i = 0; i < n; i++)
+        sys_env_destroy(children[i]);
+}
@@ -0,0 +1,66 @@
+/* Cost of a context switch (sys_yield() ping-pong between two envs)
+ * and of an IPC round trip. Compare runs on CPU models with and
+ * without PCID to see the effect of TLB-tagged address spaces */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSWITCHES 20000
+#define NROUNDS   20000
+
+/* Touch some pages so that TLB misses after flush cost something */
+#define NPAGES 64
+static uint8_t data[NPAGES * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static unsigned
+touch(void) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof data; i += PAGE_SIZE)
+        sum += data[i];
+    return sum;
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t child;
+    uint64_t start, cycles;
+    unsigned sum = 0;
+
+    for (size_t i = 0; i < sizeof data; i += PAGE_SIZE)
+        data[i] = 1;
+
+    if ((child = fork()) < 0) panic("fork: %i", child);
+
+    if (!child) {
+        for (int i = 0; i < NSWITCHES; i++) {
+            sum += touch();
+            sys_yield();
+        }
+        for (int i = 0; i < NROUNDS; i++) {
+            uint32_t val = ipc_recv(NULL, NULL, NULL, NULL);
+            sum += touch();
+            ipc_send(thisenv->env_parent_id, val, NULL, 0, 0);
+        }
+        if (sum != (NSWITCHES + NROUNDS) * NPAGES) panic("switchbench: bad sum");
+        return;
+    }
+
+    start = read_tsc();
+    for (int i = 0; i < NSWITCHES; i++) {
+        sum += touch();
+        sys_yield();
+    }
+    cycles = read_tsc() - start;
+    cprintf("switchbench: %lu cycles per switch\n", (unsigned long)(cycles / NSWITCHES / 2));
+
+    start = read_tsc();
+    for (int i = 0; i < NROUNDS; i++) {
+        ipc_send(child, i, NULL, 0, 0);
+        ipc_recv(NULL, NULL, NULL, NULL);
+        sum += touch();
+    }
+    cycles = read_tsc() - start;
+    cprintf("switchbench: %lu cycles per IPC round trip\n", (unsigned long)(cycles / NROUNDS));
+
+    wait(child);
+}
@@ -0,0 +1,48 @@
+/* Random reads over 256MB built from 4K page faults,
+ * timed before and after the kernel promotes it to 2MB pages */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION      ((uint64_t *)0x1000000000)
+#define REGION_SIZE (256ULL << 20)
+#define NWORDS      (REGION_SIZE / sizeof(uint64_t))
+#define NREADS      (1 << 22)
+
+static uint64_t
+random_reads(void) {
+    uint64_t seed = 42, sum = 0;
+    uint64_t start = read_tsc();
+
+    for (size_t i = 0; i < NREADS; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        sum += REGION[(seed >> 20) % NWORDS];
+    }
+
+    uint64_t cycles = read_tsc() - start;
+    if (sum != NREADS) panic("thpbench: bad sum %lu", (unsigned long)sum);
+    return cycles;
+}
+
+void
+umain(int argc, char **argv) {
+    int res;
+
+    if ((res = sys_alloc_region(CURENVID, REGION, REGION_SIZE, PROT_RW)) < 0)
+        panic("sys_alloc_region: %i", res);
+    /* Every page is faulted in separately and so is mapped with 4K PTE */
+    for (size_t i = 0; i < NWORDS; i++)
+        REGION[i] = 1;
+
+    uint64_t small = random_reads();
+
+    /* Let the kernel run idle promotion pass */
+    sys_sleep(500000000);
+
+    uint64_t huge = random_reads();
+
+    cprintf("thpbench: 4K pages: %lu cycles per read\n", (unsigned long)(small / NREADS));
+    cprintf("thpbench: 2MB pages: %lu cycles per read\n", (unsigned long)(huge / NREADS));
+    cprintf("thpbench: speedup %lu.%02lux\n",
+            (unsigned long)(small / huge), (unsigned long)(small * 100 / huge % 100));
+}
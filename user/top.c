@@ -0,0 +1,89 @@
+/* Show which environments use the CPU, sampled from the read-only envs[] */
+
+#include <inc/lib.h>
+
+
+static struct EnvAcct prev[NENV];
+static envid_t prev_id[NENV];
+static uint64_t prev_runtime[NENV];
+
+static void
+usage(void) {
+    printf("usage: top [iterations]\n");
+    exit();
+}
+
+/* Snapshot accounting and CPU time (TSC ticks) of all environments */
+static void
+sample(struct EnvAcct *acct, envid_t *id, uint64_t *runtime) {
+    for (size_t i = 0; i < NENV; i++) {
+        id[i] = envs[i].env_status == ENV_FREE ? 0 : envs[i].env_id;
+        acct[i] = envs[i].env_acct;
+        runtime[i] = vsys.vsys_runtime[i];
+    }
+}
+
+static void
+show(void) {
+    static struct EnvAcct cur[NENV];
+    static envid_t cur_id[NENV];
+    static uint64_t cur_runtime[NENV];
+    static uint64_t delta[NENV];
+    static int order[NENV];
+    uint64_t total = 0;
+    int n = 0;
+
+    sample(cur, cur_id, cur_runtime);
+
+    /* Sort live environments by CPU time used during the last interval */
+    for (int i = 0; i < NENV; i++) {
+        if (!cur_id[i]) continue;
+
+        delta[i] = cur_runtime[i];
+        if (prev_id[i] == cur_id[i]) delta[i] -= prev_runtime[i];
+        total += delta[i];
+
+        int j = n++;
+        for (; j > 0 && delta[order[j - 1]] < delta[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    printf("   ENVID  CPU%%  USER%%  SWITCH  PF-KERN  PF-USER  IPC-SND  IPC-RCV\n");
+    for (int k = 0; k < n; k++) {
+        int i = order[k];
+        struct EnvAcct d = cur[i];
+        if (prev_id[i] == cur_id[i]) {
+            d.acct_utime -= prev[i].acct_utime;
+            d.acct_switches -= prev[i].acct_switches;
+            d.acct_pgfault_kern -= prev[i].acct_pgfault_kern;
+            d.acct_pgfault_user -= prev[i].acct_pgfault_user;
+            d.acct_ipc_sends -= prev[i].acct_ipc_sends;
+            d.acct_ipc_recvs -= prev[i].acct_ipc_recvs;
+        }
+
+        printf("%08x %5lu %6lu %7u %8u %8u %8u %8u\n", cur_id[i],
+               (unsigned long)(total ? delta[i] * 100 / total : 0),
+               (unsigned long)(delta[i] ? MIN(d.acct_utime, delta[i]) * 100 / delta[i] : 0),
+               d.acct_switches, d.acct_pgfault_kern, d.acct_pgfault_user,
+               d.acct_ipc_sends, d.acct_ipc_recvs);
+    }
+
+    memcpy(prev, cur, sizeof(prev));
+    memcpy(prev_id, cur_id, sizeof(prev_id));
+    memcpy(prev_runtime, cur_runtime, sizeof(prev_runtime));
+}
+
+void
+umain(int argc, char **argv) {
+    long iterations = 1;
+
+    if (argc > 2) usage();
+    if (argc == 2 && (iterations = strtol(argv[1], NULL, 10)) <= 0) usage();
+
+    sample(prev, prev_id, prev_runtime);
+    while (iterations--) {
+        sys_sleep(NSEC_PER_SEC);
+        show();
+    }
+}
@@ -0,0 +1,44 @@
+/* Maps 1GB of zero-filled memory, writes to 1% of its pages
+ * and reports time spent and private memory allocated */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION      ((uint8_t *)0x1000000000)
+#define REGION_SIZE (1ULL << 30)
+#define STRIDE      (100 * PAGE_SIZE)
+
+void
+umain(int argc, char **argv) {
+    const volatile struct EnvAcct *acct = &thisenv->env_acct;
+    uint64_t start, map_cycles, touch_cycles, bytes0;
+    uint32_t faults0;
+    size_t touched = 0;
+    int res;
+
+    start = read_tsc();
+    if ((res = sys_alloc_region(CURENVID, REGION, REGION_SIZE, PROT_RW)) < 0)
+        panic("sys_alloc_region: %i", res);
+    map_cycles = read_tsc() - start;
+
+    faults0 = acct->acct_pgfault_kern;
+    bytes0 = acct->acct_fault_bytes;
+
+    start = read_tsc();
+    for (size_t off = 0; off < REGION_SIZE; off += STRIDE, touched++)
+        REGION[off] = 1;
+    touch_cycles = read_tsc() - start;
+
+    for (size_t off = 0; off < REGION_SIZE; off += PAGE_SIZE)
+        if (REGION[off] != (off % STRIDE ? 0 : 1)) panic("zerobench: bad byte at %zx", off);
+
+    cprintf("zerobench: mapped %lu MB in %lu us\n",
+            (unsigned long)(REGION_SIZE >> 20), (unsigned long)tsc2us(map_cycles, vsys.vsys_tsc_freq));
+    cprintf("zerobench: touched %zu pages in %lu us, %u faults\n",
+            touched, (unsigned long)tsc2us(touch_cycles, vsys.vsys_tsc_freq), acct->acct_pgfault_kern - faults0);
+    cprintf("zerobench: resident %lu KB of %lu KB\n",
+            (unsigned long)((acct->acct_fault_bytes - bytes0) >> 10), (unsigned long)(REGION_SIZE >> 10));
+
+    if ((res = sys_unmap_region(CURENVID, REGION, REGION_SIZE)) < 0)
+        panic("sys_unmap_region: %i", res);
+}